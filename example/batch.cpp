@@ -0,0 +1,197 @@
+/*
+ * batch.cpp
+ *
+ * Solves a batch of many independent small linear systems (n <= 64) in one
+ * run, several systems per SIMD instruction and chunks of systems per OpenMP
+ * thread (see batch.h).
+ */
+
+#include <getopt.h>
+#include <limits.h>
+#include <math.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <omp.h>
+
+// custom timing macros
+#include "timer.h"
+
+// counter-based random numbers for generated systems
+#include "rng.h"
+
+// interleaved batch layout, file format and kernels
+#include "batch.h"
+
+// use 64-bit IEEE arithmetic (change to "float" to use 32-bit arithmetic)
+#define REAL double
+
+// batch of linear systems: A_s x_s = b_s for each system s
+batch_t<REAL> bt;
+
+// enable/disable debugging output (don't enable for large batches!)
+bool debug_mode = false;
+
+// enable/disable partial pivoting
+bool pivot_mode = false;
+
+/*
+ * Generates count random n x n systems. Entry (row, col) of system s is a
+ * function of (s, row, col) only, and b is set so that every solution is all
+ * 1s.
+ */
+void rand_batch(int n, long count)
+{
+    batch_alloc(&bt, n, count);
+
+    #pragma omp parallel for default(none) shared(bt, n, count) schedule(static)
+    for (long s = 0; s < count; s++) {
+        long c = s / BATCH_LANES;
+        int l = (int)(s % BATCH_LANES);
+        for (int row = 0; row < n; row++) {
+            REAL sum = 0.0;
+            for (int col = 0; col < n; col++) {
+                REAL val = (row == col) ? n/10.0 :
+                    (REAL)rand_u31(RAND_SEED + s, row, col) / (REAL)ULONG_MAX;
+                bt.A[batch_a_index(n, c, row, col) + l] = val;
+                sum += val;
+            }
+            bt.b[batch_v_index(n, c, row) + l] = sum;
+        }
+    }
+}
+
+/*
+ * Exits with a message if elimination found a singular system.
+ */
+void check_singular()
+{
+    for (long s = 0; s < bt.count; s++) {
+        if (bt.singular[s]) {
+            printf("System %ld is singular\n", s);
+            exit(EXIT_FAILURE);
+        }
+    }
+}
+
+/*
+ * Returns the largest error over all systems (every solution should be all
+ * 1s).
+ */
+REAL find_max_error()
+{
+    REAL error = 0.0;
+    #pragma omp parallel for default(none) shared(bt) reduction(max:error) schedule(static)
+    for (long s = 0; s < bt.count; s++) {
+        long c = s / BATCH_LANES;
+        int l = (int)(s % BATCH_LANES);
+        for (int row = 0; row < bt.n; row++) {
+            REAL tmp = fabs(bt.x[batch_v_index(bt.n, c, row) + l] - 1.0);
+            if (!(tmp <= error)) {     // also catches NaN
+                error = tmp;
+            }
+        }
+    }
+    return error;
+}
+
+/*
+ * Prints the solution of every system.
+ */
+void print_solutions()
+{
+    REAL *x = (REAL*)malloc(sizeof(REAL) * bt.n);
+    for (long s = 0; s < bt.count; s++) {
+        batch_get_solution(&bt, s, x);
+        printf("x[%ld] =", s);
+        for (int row = 0; row < bt.n; row++) {
+            printf(" %8.3f", x[row]);
+        }
+        printf("\n");
+    }
+    free(x);
+}
+
+int main(int argc, char *argv[])
+{
+    long count = 1;
+    const char *write_fn = NULL;
+
+    // check and parse command line options
+    int c;
+    while ((c = getopt(argc, argv, "c:dpw:")) != -1) {
+        switch (c) {
+        case 'c':
+            count = strtol(optarg, NULL, 10);
+            if (count <= 0) {
+                printf("Invalid number of systems: %s\n", optarg);
+                exit(EXIT_FAILURE);
+            }
+            break;
+        case 'd':
+            debug_mode = true;
+            break;
+        case 'p':
+            pivot_mode = true;
+            break;
+        case 'w':
+            write_fn = optarg;
+            break;
+        default:
+            printf("Usage: %s [-dp] [-c <count>] [-w <out.bin>] <file|size>\n", argv[0]);
+            exit(EXIT_FAILURE);
+        }
+    }
+    if (optind != argc-1) {
+        printf("Usage: %s [-dp] [-c <count>] [-w <out.bin>] <file|size>\n", argv[0]);
+        exit(EXIT_FAILURE);
+    }
+
+    // read or generate the batch
+    long int size = strtol(argv[optind], NULL, 10);
+    START_TIMER(init)
+    if (size == 0) {
+        batch_read(argv[optind], &bt);
+    } else {
+        rand_batch((int)size, count);
+    }
+    STOP_TIMER(init)
+
+    // save the batch (e.g. to convert a text batch to the binary format)
+    if (write_fn != NULL) {
+        batch_write(write_fn, &bt);
+    }
+
+    // perform gaussian elimination
+    START_TIMER(gaus)
+    batch_eliminate(&bt, pivot_mode);
+    STOP_TIMER(gaus)
+    check_singular();
+
+    // perform backwards substitution
+    START_TIMER(bsub)
+    batch_back_substitution(&bt);
+    STOP_TIMER(bsub)
+
+    if (debug_mode) {
+        print_solutions();
+    }
+
+    // print results
+    printf("Nthreads=%2d  Nsystems=%ld  n=%d  ERR=%8.1e  INIT: %8.4fs  GAUS: %8.4fs  BSUB: %8.4fs\n",
+            omp_get_max_threads(), bt.count, bt.n, find_max_error(),
+            GET_TIMER(init), GET_TIMER(gaus), GET_TIMER(bsub));
+
+    // print per-phase hardware counters (if enabled with TIMER_COUNTERS)
+    perf_report(GET_COUNTERS(init), GET_TIMER(init), GET_COUNTERS(gaus), GET_TIMER(gaus),
+            GET_COUNTERS(bsub), GET_TIMER(bsub));
+
+    // write the profile (if enabled with TIMER_PROFILE)
+    profile_write();
+
+    // clean up and exit
+    batch_free(&bt);
+    return EXIT_SUCCESS;
+}
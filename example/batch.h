@@ -0,0 +1,537 @@
+/**
+ * batch.h
+ *
+ * Batched solver for many independent small systems (n <= BATCH_MAX_N).
+ *
+ * Solving a 4 x 4 system with the regular backends costs a process start and,
+ * in the parallel ones, a fork/join per pivot that dwarfs the arithmetic. Here
+ * a whole batch of equally sized systems is solved at once: BATCH_LANES
+ * systems are interleaved so that entry (i, j) of all of them is contiguous
+ * (structure of arrays), and every operation of the elimination is applied to
+ * the BATCH_LANES systems with one vector instruction, one system per SIMD
+ * lane. Groups of BATCH_LANES systems (chunks) are independent and are
+ * distributed over the OpenMP threads.
+ *
+ * Layout of chunk c (lane l holds system c*BATCH_LANES + l):
+ *
+ *      A[((c*n + i)*n + j)*BATCH_LANES + l]      entry (i, j)
+ *      b[(c*n + i)*BATCH_LANES + l]              entry i (x likewise)
+ *
+ * The kernels take n as a template parameter, so for the common small sizes
+ * (2 to 8 and 16) every loop has a constant trip count and is fully unrolled;
+ * other sizes use the same code with a run-time n. The unused lanes of the
+ * last chunk hold identity systems.
+ *
+ * With partial pivoting each lane picks its own pivot row, and the rows are
+ * swapped in place in that lane only (A and b of the other systems in the
+ * chunk are untouched).
+ *
+ * Binary batch file (in the byte order of the machine that wrote it):
+ *
+ *      offset 0        batch_header_t
+ *      data_offset     count systems, each n x n values of A (row-major)
+ *                      followed by the n values of b
+ *
+ * The text format is any number of systems in the solvers' text format (see
+ * matrix_io.h), one after the other.
+ *
+ * Example:
+ *
+ *      batch_t<REAL> bt;
+ *      batch_alloc(&bt, n, count);
+ *      batch_set_system(&bt, s, sys_A, sys_b);       // for each system s
+ *      batch_eliminate(&bt, pivot_mode);
+ *      batch_back_substitution(&bt);
+ *      batch_get_solution(&bt, s, sys_x);
+ *      batch_free(&bt);
+ */
+
+#ifndef BATCH_H
+#define BATCH_H
+
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "matrix_io.h"
+
+// systems per chunk (8 doubles fill an AVX-512 register, two AVX2 ones)
+#define BATCH_LANES 8
+
+// largest system size supported
+#define BATCH_MAX_N 64
+
+#define BATCH_MAGIC     "MATBATCH"
+#define BATCH_VERSION   1
+
+typedef struct {
+    char     magic[8];          // BATCH_MAGIC (not NUL-terminated)
+    uint32_t version;           // BATCH_VERSION
+    uint32_t endian;            // MATRIX_ENDIAN as written by the producer
+    uint32_t elem_size;         // 4 (float) or 8 (double)
+    uint32_t n;                 // rows/columns of each system
+    uint64_t count;             // number of systems
+    uint64_t data_offset;       // byte offset of the first system
+} batch_header_t;
+
+template <typename T>
+struct batch_t {
+    int   n;
+    long  count;                // number of systems
+    long  chunks;               // count rounded up to whole chunks
+    T    *A;                    // interleaved as described above
+    T    *b;
+    T    *x;
+    bool *singular;             // per system, set by elimination on a zero pivot
+};
+
+/*
+ * Index of entry (i, j) of A, lane 0, in chunk c.
+ */
+static inline size_t batch_a_index(int n, long c, int i, int j)
+{
+    return (((size_t)c*n + i)*n + j) * BATCH_LANES;
+}
+
+/*
+ * Index of entry i of b or x, lane 0, in chunk c.
+ */
+static inline size_t batch_v_index(int n, long c, int i)
+{
+    return ((size_t)c*n + i) * BATCH_LANES;
+}
+
+/*
+ * Allocates a batch of count n x n systems. Every lane starts out as the
+ * identity system with b = 1, so padding lanes stay well defined.
+ */
+template <typename T>
+static void batch_alloc(batch_t<T> *bt, int n, long count)
+{
+    if (n < 1 || n > BATCH_MAX_N || count < 1) {
+        printf("Batched systems must have 1 <= n <= %d (got n=%d, %ld systems)\n",
+                BATCH_MAX_N, n, count);
+        exit(EXIT_FAILURE);
+    }
+    bt->n = n;
+    bt->count = count;
+    bt->chunks = (count + BATCH_LANES - 1) / BATCH_LANES;
+    size_t vlen = (size_t)bt->chunks * n * BATCH_LANES;
+    bt->A = (T *)matrix_alloc(sizeof(T) * vlen * n);
+    bt->b = (T *)matrix_alloc(sizeof(T) * vlen);
+    bt->x = (T *)matrix_alloc(sizeof(T) * vlen);
+    bt->singular = (bool *)calloc(bt->chunks * BATCH_LANES, sizeof(bool));
+    if (bt->A == NULL || bt->b == NULL || bt->x == NULL || bt->singular == NULL) {
+        printf("Unable to allocate memory for linear systems\n");
+        exit(EXIT_FAILURE);
+    }
+
+    #pragma omp parallel for schedule(static)
+    for (long c = 0; c < bt->chunks; c++) {
+        for (int i = 0; i < n; i++) {
+            for (int l = 0; l < BATCH_LANES; l++) {
+                bt->A[batch_a_index(n, c, i, i) + l] = 1.0;
+                bt->b[batch_v_index(n, c, i) + l] = 1.0;
+            }
+        }
+    }
+}
+
+template <typename T>
+static void batch_free(batch_t<T> *bt)
+{
+    matrix_free(bt->A);
+    matrix_free(bt->b);
+    matrix_free(bt->x);
+    free(bt->singular);
+}
+
+/*
+ * Copies system s (A row-major with row stride n, and b) into its lane.
+ */
+template <typename T, typename U>
+static void batch_set_system(batch_t<T> *bt, long s, const U *sys_A, const U *sys_b)
+{
+    int n = bt->n;
+    long c = s / BATCH_LANES;
+    int l = (int)(s % BATCH_LANES);
+    for (int i = 0; i < n; i++) {
+        for (int j = 0; j < n; j++) {
+            bt->A[batch_a_index(n, c, i, j) + l] = (T)sys_A[i*n + j];
+        }
+        bt->b[batch_v_index(n, c, i) + l] = (T)sys_b[i];
+    }
+}
+
+/*
+ * Copies system s (A, overwritten by its factors after elimination, and b)
+ * out of its lane.
+ */
+template <typename T>
+static void batch_get_system(const batch_t<T> *bt, long s, T *sys_A, T *sys_b)
+{
+    int n = bt->n;
+    long c = s / BATCH_LANES;
+    int l = (int)(s % BATCH_LANES);
+    for (int i = 0; i < n; i++) {
+        for (int j = 0; j < n; j++) {
+            sys_A[i*n + j] = bt->A[batch_a_index(n, c, i, j) + l];
+        }
+        sys_b[i] = bt->b[batch_v_index(n, c, i) + l];
+    }
+}
+
+/*
+ * Copies the solution of system s out of its lane.
+ */
+template <typename T>
+static void batch_get_solution(const batch_t<T> *bt, long s, T *sys_x)
+{
+    int n = bt->n;
+    long c = s / BATCH_LANES;
+    int l = (int)(s % BATCH_LANES);
+    for (int i = 0; i < n; i++) {
+        sys_x[i] = bt->x[batch_v_index(n, c, i) + l];
+    }
+}
+
+/*
+ * Partial pivoting for column k of one chunk: each lane finds its largest
+ * remaining entry in column k and swaps that row with row k (A and b).
+ */
+template <typename T>
+static void batch_pivot_chunk(T *__restrict A, T *__restrict b, int n, int k, bool *singular)
+{
+    for (int l = 0; l < BATCH_LANES; l++) {
+        int best = k;
+        T best_val = fabs(A[(k*n + k)*BATCH_LANES + l]);
+        for (int i = k+1; i < n; i++) {
+            T val = fabs(A[(i*n + k)*BATCH_LANES + l]);
+            if (val > best_val) {
+                best_val = val;
+                best = i;
+            }
+        }
+        if (best_val == 0.0) {
+            singular[l] = true;
+        }
+        if (best != k) {
+            for (int j = 0; j < n; j++) {
+                T tmp = A[(k*n + j)*BATCH_LANES + l];
+                A[(k*n + j)*BATCH_LANES + l] = A[(best*n + j)*BATCH_LANES + l];
+                A[(best*n + j)*BATCH_LANES + l] = tmp;
+            }
+            T tmp = b[k*BATCH_LANES + l];
+            b[k*BATCH_LANES + l] = b[best*BATCH_LANES + l];
+            b[best*BATCH_LANES + l] = tmp;
+        }
+    }
+}
+
+/*
+ * Gaussian elimination of one chunk (A and b updated in place, multipliers
+ * kept below the diagonal). N is the system size if it is known at compile
+ * time, or 0 to use n. A lane is marked singular if it has no nonzero pivot
+ * (after pivoting) or a zero pivot (without pivoting).
+ */
+template <typename T, int N>
+static void batch_eliminate_chunk(T *__restrict A, T *__restrict b, int n, bool pivot,
+        bool *singular)
+{
+    if (N > 0) {
+        n = N;
+    }
+    for (int k = 0; k < n; k++) {
+        if (pivot) {
+            batch_pivot_chunk(A, b, n, k, singular);
+        } else {
+            for (int l = 0; l < BATCH_LANES; l++) {
+                if (A[(k*n + k)*BATCH_LANES + l] == 0.0) {
+                    singular[l] = true;
+                }
+            }
+        }
+        const T *pivot_row = &A[k*n*BATCH_LANES];
+        for (int i = k+1; i < n; i++) {
+            T *row = &A[i*n*BATCH_LANES];
+            T coeff[BATCH_LANES];
+            #pragma omp simd
+            for (int l = 0; l < BATCH_LANES; l++) {
+                coeff[l] = row[k*BATCH_LANES + l] / pivot_row[k*BATCH_LANES + l];
+                row[k*BATCH_LANES + l] = coeff[l];
+            }
+            for (int j = k+1; j < n; j++) {
+                #pragma omp simd
+                for (int l = 0; l < BATCH_LANES; l++) {
+                    row[j*BATCH_LANES + l] -= pivot_row[j*BATCH_LANES + l] * coeff[l];
+                }
+            }
+            #pragma omp simd
+            for (int l = 0; l < BATCH_LANES; l++) {
+                b[i*BATCH_LANES + l] -= b[k*BATCH_LANES + l] * coeff[l];
+            }
+        }
+    }
+}
+
+/*
+ * Back substitution of one (eliminated) chunk into x. N as above.
+ */
+template <typename T, int N>
+static void batch_back_substitution_chunk(const T *__restrict A, const T *__restrict b,
+        T *__restrict x, int n)
+{
+    if (N > 0) {
+        n = N;
+    }
+    for (int i = n-1; i >= 0; i--) {
+        const T *row = &A[i*n*BATCH_LANES];
+        T sum[BATCH_LANES];
+        #pragma omp simd
+        for (int l = 0; l < BATCH_LANES; l++) {
+            sum[l] = b[i*BATCH_LANES + l];
+        }
+        for (int j = i+1; j < n; j++) {
+            #pragma omp simd
+            for (int l = 0; l < BATCH_LANES; l++) {
+                sum[l] -= row[j*BATCH_LANES + l] * x[j*BATCH_LANES + l];
+            }
+        }
+        #pragma omp simd
+        for (int l = 0; l < BATCH_LANES; l++) {
+            x[i*BATCH_LANES + l] = sum[l] / row[i*BATCH_LANES + l];
+        }
+    }
+}
+
+/*
+ * Kernels for one system size, picked once per batch.
+ */
+template <typename T>
+struct batch_kernels_t {
+    void (*eliminate)(T *, T *, int, bool, bool *);
+    void (*back_substitution)(const T *, const T *, T *, int);
+};
+
+template <typename T, int N>
+static batch_kernels_t<T> batch_kernels_for()
+{
+    return { batch_eliminate_chunk<T, N>, batch_back_substitution_chunk<T, N> };
+}
+
+template <typename T>
+static batch_kernels_t<T> batch_select(int n)
+{
+    switch (n) {
+    case 2:  return batch_kernels_for<T, 2>();
+    case 3:  return batch_kernels_for<T, 3>();
+    case 4:  return batch_kernels_for<T, 4>();
+    case 5:  return batch_kernels_for<T, 5>();
+    case 6:  return batch_kernels_for<T, 6>();
+    case 7:  return batch_kernels_for<T, 7>();
+    case 8:  return batch_kernels_for<T, 8>();
+    case 16: return batch_kernels_for<T, 16>();
+    default: return batch_kernels_for<T, 0>();
+    }
+}
+
+/*
+ * Eliminates every system in the batch, one chunk per loop iteration.
+ */
+template <typename T>
+static void batch_eliminate(batch_t<T> *bt, bool pivot)
+{
+    batch_kernels_t<T> k = batch_select<T>(bt->n);
+    int n = bt->n;
+    #pragma omp parallel for schedule(static)
+    for (long c = 0; c < bt->chunks; c++) {
+        k.eliminate(&bt->A[batch_a_index(n, c, 0, 0)], &bt->b[batch_v_index(n, c, 0)], n,
+                pivot, &bt->singular[c*BATCH_LANES]);
+    }
+}
+
+/*
+ * Solves every eliminated system in the batch for x.
+ */
+template <typename T>
+static void batch_back_substitution(batch_t<T> *bt)
+{
+    batch_kernels_t<T> k = batch_select<T>(bt->n);
+    int n = bt->n;
+    #pragma omp parallel for schedule(static)
+    for (long c = 0; c < bt->chunks; c++) {
+        k.back_substitution(&bt->A[batch_a_index(n, c, 0, 0)], &bt->b[batch_v_index(n, c, 0)],
+                &bt->x[batch_v_index(n, c, 0)], n);
+    }
+}
+
+/*
+ * Reads a binary batch file into bt (values converted to T). Returns false
+ * (without printing anything) if the file is not a binary batch file, so the
+ * caller can fall back to the text format.
+ */
+template <typename T>
+static bool batch_read_binary(const char *fn, batch_t<T> *bt)
+{
+    FILE *fin = fopen(fn, "rb");
+    if (fin == NULL) {
+        return false;
+    }
+    batch_header_t h;
+    if (fread(&h, sizeof(h), 1, fin) != 1 ||
+            memcmp(h.magic, BATCH_MAGIC, sizeof(h.magic)) != 0) {
+        fclose(fin);
+        return false;
+    }
+    if (h.endian != MATRIX_ENDIAN) {
+        printf("Batch file \"%s\" has the wrong byte order for this machine\n", fn);
+        exit(EXIT_FAILURE);
+    }
+    if (h.version != BATCH_VERSION || (h.elem_size != 4 && h.elem_size != 8)) {
+        printf("Invalid batch file format\n");
+        exit(EXIT_FAILURE);
+    }
+
+    batch_alloc(bt, (int)h.n, (long)h.count);
+    int n = bt->n;
+    size_t per_system = (size_t)n*n + n;
+    char *buf = (char *)malloc(per_system * h.elem_size);
+    double *vals = (double *)malloc(per_system * sizeof(double));
+    if (buf == NULL || vals == NULL || fseek(fin, (long)h.data_offset, SEEK_SET) != 0) {
+        printf("Unable to read batch file \"%s\"\n", fn);
+        exit(EXIT_FAILURE);
+    }
+    for (long s = 0; s < bt->count; s++) {
+        if (fread(buf, h.elem_size, per_system, fin) != per_system) {
+            printf("Invalid batch file format\n");
+            exit(EXIT_FAILURE);
+        }
+        for (size_t i = 0; i < per_system; i++) {
+            vals[i] = (h.elem_size == 4) ? ((float *)buf)[i] : ((double *)buf)[i];
+        }
+        batch_set_system(bt, s, vals, vals + (size_t)n*n);
+    }
+    free(buf);
+    free(vals);
+    fclose(fin);
+    return true;
+}
+
+/*
+ * Reads a text batch file (systems in the text format, one after the other)
+ * into bt. All systems must have the same size. Prints a message and exits
+ * on malformed input.
+ */
+template <typename T>
+static void batch_read_text(const char *fn, batch_t<T> *bt)
+{
+    FILE *fin = fopen(fn, "r");
+    if (fin == NULL) {
+        printf("Unable to open file \"%s\"\n", fn);
+        exit(EXIT_FAILURE);
+    }
+
+    // systems are parsed into a contiguous buffer first, since the number of
+    // systems is only known at the end of the file
+    int n = 0, sys_n;
+    long count = 0, cap = 0;
+    double *vals = NULL;
+    while (fscanf(fin, "%d", &sys_n) == 1) {
+        if (n == 0) {
+            n = sys_n;
+            if (n < 1 || n > BATCH_MAX_N) {
+                printf("Batched systems must have 1 <= n <= %d (got n=%d)\n", BATCH_MAX_N, n);
+                exit(EXIT_FAILURE);
+            }
+        } else if (sys_n != n) {
+            printf("All systems in a batch must have the same size (%d and %d)\n", n, sys_n);
+            exit(EXIT_FAILURE);
+        }
+        size_t per_system = (size_t)n*n + n;
+        if (count == cap) {
+            cap = cap ? cap*2 : 1024;
+            vals = (double *)realloc(vals, sizeof(double) * per_system * cap);
+            if (vals == NULL) {
+                printf("Unable to allocate memory for linear systems\n");
+                exit(EXIT_FAILURE);
+            }
+        }
+
+        // each row holds n entries of A followed by one entry of b
+        double *sys = vals + per_system * count;
+        for (int i = 0; i < n; i++) {
+            for (int j = 0; j <= n; j++) {
+                double *dst = (j < n) ? &sys[i*n + j] : &sys[(size_t)n*n + i];
+                if (fscanf(fin, "%lf", dst) != 1) {
+                    printf("Invalid matrix file format\n");
+                    exit(EXIT_FAILURE);
+                }
+            }
+        }
+        count++;
+    }
+    if (!feof(fin) || count == 0) {
+        printf("Invalid matrix file format\n");
+        exit(EXIT_FAILURE);
+    }
+    fclose(fin);
+
+    batch_alloc(bt, n, count);
+    size_t per_system = (size_t)n*n + n;
+    #pragma omp parallel for schedule(static)
+    for (long s = 0; s < count; s++) {
+        batch_set_system(bt, s, vals + per_system*s, vals + per_system*s + (size_t)n*n);
+    }
+    free(vals);
+}
+
+/*
+ * Reads a batch file in either format.
+ */
+template <typename T>
+static void batch_read(const char *fn, batch_t<T> *bt)
+{
+    if (!batch_read_binary(fn, bt)) {
+        batch_read_text(fn, bt);
+    }
+}
+
+/*
+ * Writes the batch (its current A and b) as a binary batch file.
+ */
+template <typename T>
+static void batch_write(const char *fn, const batch_t<T> *bt)
+{
+    batch_header_t h;
+    memset(&h, 0, sizeof(h));
+    memcpy(h.magic, BATCH_MAGIC, sizeof(h.magic));
+    h.version = BATCH_VERSION;
+    h.endian = MATRIX_ENDIAN;
+    h.elem_size = (uint32_t)sizeof(T);
+    h.n = (uint32_t)bt->n;
+    h.count = (uint64_t)bt->count;
+    h.data_offset = sizeof(h);
+
+    FILE *fout = fopen(fn, "wb");
+    if (fout == NULL) {
+        printf("Unable to open file \"%s\"\n", fn);
+        exit(EXIT_FAILURE);
+    }
+    int n = bt->n;
+    size_t per_system = (size_t)n*n + n;
+    T *sys = (T *)malloc(sizeof(T) * per_system);
+    bool ok = (sys != NULL) && fwrite(&h, sizeof(h), 1, fout) == 1;
+    for (long s = 0; ok && s < bt->count; s++) {
+        batch_get_system(bt, s, sys, sys + (size_t)n*n);
+        ok = fwrite(sys, sizeof(T), per_system, fout) == per_system;
+    }
+    free(sys);
+    if (fclose(fout) != 0 || !ok) {
+        printf("Unable to write output file\n");
+        exit(EXIT_FAILURE);
+    }
+}
+
+#endif  // BATCH_H
@@ -0,0 +1,722 @@
+/*
+ * bench.cpp
+ *
+ * Benchmark driver for the CPU backends. Replaces the srun loops in the
+ * timing scripts: it sweeps over backends, sizes and thread counts, runs
+ * warmup and timed trials of each configuration and writes the statistics
+ * as CSV or JSON.
+ *
+ * Each backend is loaded from a shared library (see bench.h). Every
+ * configuration runs in a forked child process, so it gets a fresh copy of
+ * the backend's globals and OpenMP runtime, can be pinned to its own CPUs,
+ * and cannot take the driver down if it calls exit().
+ *
+ * With -c, the configurations are instead read from a baseline CSV written
+ * by an earlier run, and the driver exits with an error if any of them got
+ * significantly slower (see compare_baseline()). The baseline must have been
+ * run with the same backend options and number of trials.
+ *
+ * Usage: bench [-P] [-B <backends>] [-n <sizes>] [-T <threads>] [-w <warmup>]
+ *              [-r <trials>] [-f csv|json] [-o <file>] [-c <baseline.csv>]
+ *              [-x <percent>] [-L <libdir>] [-- <backend options>]
+ *
+ * Lists are comma-separated, e.g. ./out/bench -n 1000,2000 -T 1,2,4 -- -p
+ */
+
+#include <dlfcn.h>
+#include <getopt.h>
+#include <math.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+#include "bench.h"
+
+#define MAX_LIST 64
+#define MAX_ARGS 64
+#define MAX_OPTIONS 1024
+
+// fewest trials for which the confidence interval of the median reaches 95%
+// (with 5 trials even [min, max] only covers it with probability 94%)
+#define MIN_CI_TRIALS 6
+
+// statistics of one configuration (all times in seconds)
+typedef struct {
+    const char *backend;
+    int n;
+    int threads;
+    int trials;
+    double err;             // largest error over all trials
+    double init;            // median phase times
+    double gaus;
+    double bsub;
+    double min;             // statistics of the solve time (GAUS + BSUB)
+    double p05;
+    double median;
+    double ci_lo;           // 95% confidence interval of the median
+    double ci_hi;
+    double p95;
+    double mean;
+    double stddev;
+    double gflops;          // at the median solve time
+} bench_stats_t;
+
+// one configuration to run, and its baseline median, confidence interval,
+// number of trials and backend options (all zero when not comparing against
+// a baseline; trials is also 0 and options NULL for older baselines that
+// didn't record them)
+typedef struct {
+    char backend[64];
+    int n;
+    int threads;
+    double median;
+    double ci_lo;
+    double ci_hi;
+    int trials;
+    char *options;
+} bench_config_t;
+
+// options shared by every configuration
+int warmup = 2;
+int trials = 10;
+bool pin_mode = false;
+const char *lib_dir = "out";
+char *backend_args[MAX_ARGS];
+int backend_argc = 0;
+int nrhs = 1;
+
+// the backend options joined by spaces, as recorded in the results
+char backend_options[MAX_OPTIONS] = "";
+
+/*
+ * Parses a comma-separated list of positive integers.
+ */
+int parse_int_list(const char *str, int *list)
+{
+    int count = 0;
+    char *copy = strdup(str);
+    for (char *tok = strtok(copy, ","); tok != NULL; tok = strtok(NULL, ",")) {
+        char *endptr;
+        long val = strtol(tok, &endptr, 10);
+        if (*endptr != '\0' || val <= 0 || count == MAX_LIST) {
+            fprintf(stderr, "Invalid list: %s\n", str);
+            exit(EXIT_FAILURE);
+        }
+        list[count++] = (int)val;
+    }
+    free(copy);
+    return count;
+}
+
+/*
+ * Splits a comma-separated list of names (the strings are not freed).
+ */
+int parse_name_list(const char *str, char **list)
+{
+    int count = 0;
+    char *copy = strdup(str);
+    for (char *tok = strtok(copy, ","); tok != NULL; tok = strtok(NULL, ",")) {
+        if (count == MAX_LIST) {
+            fprintf(stderr, "Too many backends: %s\n", str);
+            exit(EXIT_FAILURE);
+        }
+        list[count++] = tok;
+    }
+    return count;
+}
+
+/*
+ * Restricts the calling process (and every thread it creates) to the first
+ * threads online CPUs, so that runs do not migrate between cores.
+ */
+void pin_cpus(int threads)
+{
+    long ncpus = sysconf(_SC_NPROCESSORS_ONLN);
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    for (int i = 0; i < threads; i++) {
+        CPU_SET(i % ncpus, &set);
+    }
+    if (sched_setaffinity(0, sizeof(set), &set) != 0) {
+        perror("sched_setaffinity");
+    }
+}
+
+int compare_doubles(const void *a, const void *b)
+{
+    double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+/*
+ * Returns the p-th percentile (0 <= p <= 1) of sorted values, interpolating
+ * linearly between the closest ranks.
+ */
+double percentile(const double *sorted, int count, double p)
+{
+    double rank = p * (count - 1);
+    int lo = (int)rank;
+    int hi = lo + 1 < count ? lo + 1 : lo;
+    return sorted[lo] + (rank - lo) * (sorted[hi] - sorted[lo]);
+}
+
+/*
+ * Finds a 95% confidence interval for the median of sorted values. The
+ * number of values below the true median is Binomial(count, 1/2), so the
+ * interval between the j-th smallest and j-th largest value (counting from
+ * 1) covers it with probability 1 - 2 P(X < j). The largest j with
+ * P(X < j) <= 2.5% gives the narrowest interval with at least 95% coverage.
+ * This makes no assumption about the shape of the timing distribution,
+ * which is usually skewed by outliers. With fewer than MIN_CI_TRIALS values
+ * no interval reaches 95%, and [min, max] (the widest one) is returned.
+ */
+void median_ci(const double *sorted, int count, double *lo, double *hi)
+{
+    double tail = 0.0;
+    int j = 0;
+    while (j < (count - 1) / 2) {
+        double pmf = exp(lgamma(count + 1.0) - lgamma(j + 1.0) - lgamma(count - j + 1.0)
+                - count * log(2.0));
+        if (tail + pmf > 0.025) {
+            break;
+        }
+        tail += pmf;
+        j++;
+    }
+    if (j == 0) {
+        j = 1;
+    }
+    *lo = sorted[j - 1];
+    *hi = sorted[count - j];
+}
+
+/*
+ * Runs the warmup and timed trials of one configuration inside the calling
+ * (child) process and writes one bench_result_t per timed trial to fd.
+ */
+void run_child(const char *backend, int n, int threads, int fd)
+{
+    if (pin_mode) {
+        pin_cpus(threads);
+    }
+#   ifdef _OPENMP
+    omp_set_num_threads(threads);
+#   endif
+
+    char path[4096];
+    snprintf(path, sizeof(path), "%s/lib%s.so", lib_dir, backend);
+    void *lib = dlopen(path, RTLD_NOW | RTLD_LOCAL);
+    if (lib == NULL) {
+        fprintf(stderr, "Unable to load backend: %s\n", dlerror());
+        exit(EXIT_FAILURE);
+    }
+    bench_entry_t entry = (bench_entry_t)dlsym(lib, BENCH_ENTRY);
+    if (entry == NULL) {
+        fprintf(stderr, "Backend %s has no %s()\n", backend, BENCH_ENTRY);
+        exit(EXIT_FAILURE);
+    }
+
+    // build the backend's command line: name [options] size [threads]
+    char size_arg[16], threads_arg[16];
+    snprintf(size_arg, sizeof(size_arg), "%d", n);
+    snprintf(threads_arg, sizeof(threads_arg), "%d", threads);
+    char *argv[MAX_ARGS + 4];
+    int argc = 0;
+    argv[argc++] = (char *)backend;
+    for (int i = 0; i < backend_argc; i++) {
+        argv[argc++] = backend_args[i];
+    }
+    argv[argc++] = size_arg;
+    if (strcmp(backend, "pthread") == 0) {
+        argv[argc++] = threads_arg;
+    }
+    argv[argc] = NULL;
+
+    for (int i = 0; i < warmup + trials; i++) {
+        bench_result_t result;
+        if (entry(argc, argv, &result) != EXIT_SUCCESS) {
+            exit(EXIT_FAILURE);
+        }
+        if (i >= warmup && write(fd, &result, sizeof(result)) != sizeof(result)) {
+            perror("write");
+            exit(EXIT_FAILURE);
+        }
+    }
+    exit(EXIT_SUCCESS);
+}
+
+/*
+ * Runs one configuration in a child process and summarizes its trials.
+ * Returns false if the backend failed.
+ */
+bool run_config(const char *backend, int n, int threads, bench_stats_t *stats)
+{
+    int fds[2];
+    if (pipe(fds) != 0) {
+        perror("pipe");
+        exit(EXIT_FAILURE);
+    }
+    fflush(NULL);
+    pid_t pid = fork();
+    if (pid < 0) {
+        perror("fork");
+        exit(EXIT_FAILURE);
+    }
+    if (pid == 0) {
+        close(fds[0]);
+        run_child(backend, n, threads, fds[1]);
+    }
+    close(fds[1]);
+
+    bench_result_t *results = (bench_result_t *)malloc(trials * sizeof(bench_result_t));
+    int count = 0;
+    while (count < trials) {
+        ssize_t got = 0;
+        char *dst = (char *)&results[count];
+        while (got < (ssize_t)sizeof(bench_result_t)) {
+            ssize_t r = read(fds[0], dst + got, sizeof(bench_result_t) - got);
+            if (r <= 0) {
+                break;
+            }
+            got += r;
+        }
+        if (got != sizeof(bench_result_t)) {
+            break;
+        }
+        count++;
+    }
+    close(fds[0]);
+    int status;
+    waitpid(pid, &status, 0);
+    if (count < trials || !WIFEXITED(status) || WEXITSTATUS(status) != EXIT_SUCCESS) {
+        free(results);
+        return false;
+    }
+
+    double *solve = (double *)malloc(trials * sizeof(double));
+    double *init = (double *)malloc(trials * sizeof(double));
+    double *gaus = (double *)malloc(trials * sizeof(double));
+    double *bsub = (double *)malloc(trials * sizeof(double));
+    stats->backend = backend;
+    stats->n = n;
+    stats->threads = results[0].threads;
+    stats->trials = trials;
+    stats->err = 0.0;
+    double sum = 0.0;
+    for (int i = 0; i < trials; i++) {
+        init[i] = results[i].init;
+        gaus[i] = results[i].gaus;
+        bsub[i] = results[i].bsub;
+        solve[i] = results[i].gaus + results[i].bsub;
+        sum += solve[i];
+        if (results[i].err > stats->err) {
+            stats->err = results[i].err;
+        }
+    }
+    qsort(solve, trials, sizeof(double), compare_doubles);
+    qsort(init, trials, sizeof(double), compare_doubles);
+    qsort(gaus, trials, sizeof(double), compare_doubles);
+    qsort(bsub, trials, sizeof(double), compare_doubles);
+
+    stats->init = percentile(init, trials, 0.5);
+    stats->gaus = percentile(gaus, trials, 0.5);
+    stats->bsub = percentile(bsub, trials, 0.5);
+    stats->min = solve[0];
+    stats->p05 = percentile(solve, trials, 0.05);
+    stats->median = percentile(solve, trials, 0.5);
+    median_ci(solve, trials, &stats->ci_lo, &stats->ci_hi);
+    stats->p95 = percentile(solve, trials, 0.95);
+    stats->mean = sum / trials;
+    double var = 0.0;
+    for (int i = 0; i < trials; i++) {
+        var += (solve[i] - stats->mean) * (solve[i] - stats->mean);
+    }
+    stats->stddev = trials > 1 ? sqrt(var / (trials - 1)) : 0.0;
+
+    // elimination (2n^3/3) plus forward and back substitution (2n^2 per rhs)
+    double flops = 2.0 * n * n * n / 3.0 + 2.0 * nrhs * (double)n * n;
+    stats->gflops = stats->median > 0.0 ? flops / stats->median * 1e-9 : 0.0;
+
+    free(solve);
+    free(init);
+    free(gaus);
+    free(bsub);
+    free(results);
+    return true;
+}
+
+void write_csv_header(FILE *fout)
+{
+    fprintf(fout, "backend,n,threads,trials,err,init_s,gaus_s,bsub_s,"
+            "solve_min_s,solve_p05_s,solve_median_s,solve_ci_lo_s,solve_ci_hi_s,"
+            "solve_p95_s,solve_mean_s,solve_stddev_s,gflops,options\n");
+}
+
+void write_csv_row(FILE *fout, const bench_stats_t *s)
+{
+    fprintf(fout, "%s,%d,%d,%d,%.3e,%.6f,%.6f,%.6f,%.6f,%.6f,%.6f,%.6f,%.6f,%.6f,%.6f,%.6f,%.3f,%s\n",
+            s->backend, s->n, s->threads, s->trials, s->err, s->init, s->gaus, s->bsub,
+            s->min, s->p05, s->median, s->ci_lo, s->ci_hi, s->p95, s->mean, s->stddev,
+            s->gflops, backend_options);
+}
+
+void write_json_row(FILE *fout, const bench_stats_t *s, bool first)
+{
+    fprintf(fout, "%s  {\"backend\": \"%s\", \"n\": %d, \"threads\": %d, \"trials\": %d, "
+            "\"err\": %.3e, \"init_s\": %.6f, \"gaus_s\": %.6f, \"bsub_s\": %.6f, "
+            "\"solve_min_s\": %.6f, \"solve_p05_s\": %.6f, \"solve_median_s\": %.6f, "
+            "\"solve_ci_lo_s\": %.6f, \"solve_ci_hi_s\": %.6f, "
+            "\"solve_p95_s\": %.6f, \"solve_mean_s\": %.6f, \"solve_stddev_s\": %.6f, "
+            "\"gflops\": %.3f, \"options\": \"%s\"}",
+            first ? "" : ",\n", s->backend, s->n, s->threads, s->trials, s->err,
+            s->init, s->gaus, s->bsub, s->min, s->p05, s->median, s->ci_lo, s->ci_hi,
+            s->p95, s->mean, s->stddev, s->gflops, backend_options);
+}
+
+/*
+ * Reads the configurations and their medians from a baseline CSV written by
+ * an earlier run. Columns are found by name, so older files without the
+ * confidence interval columns still load (the 5th and 95th percentiles are
+ * used instead), as do files without the options column. Returns the number
+ * of configurations.
+ */
+int read_baseline(const char *file, bench_config_t *configs)
+{
+    FILE *fin = fopen(file, "r");
+    if (fin == NULL) {
+        fprintf(stderr, "Unable to open baseline: %s\n", file);
+        exit(EXIT_FAILURE);
+    }
+
+    // map the columns we need from the header line
+    enum { BACKEND, N, THREADS, MEDIAN, CI_LO, CI_HI, P05, P95, TRIALS, OPTIONS, NCOLS };
+    const char *names[NCOLS] = { "backend", "n", "threads", "solve_median_s",
+            "solve_ci_lo_s", "solve_ci_hi_s", "solve_p05_s", "solve_p95_s", "trials",
+            "options" };
+    int cols[NCOLS];
+    for (int i = 0; i < NCOLS; i++) {
+        cols[i] = -1;
+    }
+    char line[4096];
+    if (fgets(line, sizeof(line), fin) == NULL) {
+        fprintf(stderr, "Empty baseline: %s\n", file);
+        exit(EXIT_FAILURE);
+    }
+    line[strcspn(line, "\r\n")] = '\0';
+    int col = 0;
+    for (char *tok = strtok(line, ","); tok != NULL; tok = strtok(NULL, ","), col++) {
+        for (int i = 0; i < NCOLS; i++) {
+            if (strcmp(tok, names[i]) == 0) {
+                cols[i] = col;
+            }
+        }
+    }
+    if (cols[CI_LO] < 0 || cols[CI_HI] < 0) {
+        cols[CI_LO] = cols[P05];
+        cols[CI_HI] = cols[P95];
+    }
+    for (int i = 0; i <= CI_HI; i++) {
+        if (cols[i] < 0) {
+            fprintf(stderr, "Baseline %s has no %s column\n", file, names[i]);
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    int count = 0;
+    while (fgets(line, sizeof(line), fin) != NULL) {
+        line[strcspn(line, "\r\n")] = '\0';
+        if (line[0] == '\0') {
+            continue;
+        }
+        if (count == MAX_LIST * MAX_LIST) {
+            fprintf(stderr, "Too many configurations in baseline: %s\n", file);
+            exit(EXIT_FAILURE);
+        }
+        bench_config_t *cfg = &configs[count];
+        memset(cfg, 0, sizeof(*cfg));
+        col = 0;
+        for (char *tok = strtok(line, ","); tok != NULL; tok = strtok(NULL, ","), col++) {
+            if (col == cols[BACKEND]) {
+                snprintf(cfg->backend, sizeof(cfg->backend), "%s", tok);
+            } else if (col == cols[N]) {
+                cfg->n = atoi(tok);
+            } else if (col == cols[THREADS]) {
+                cfg->threads = atoi(tok);
+            }
+            if (col == cols[MEDIAN]) {
+                cfg->median = atof(tok);
+            }
+            if (col == cols[CI_LO]) {
+                cfg->ci_lo = atof(tok);
+            }
+            if (col == cols[CI_HI]) {
+                cfg->ci_hi = atof(tok);
+            }
+            if (col == cols[TRIALS]) {
+                cfg->trials = atoi(tok);
+            }
+            if (col == cols[OPTIONS]) {
+                cfg->options = strdup(tok);
+            }
+        }
+        // the options are the last column, and strtok() skips it when empty
+        if (cols[OPTIONS] >= 0 && cfg->options == NULL) {
+            cfg->options = strdup("");
+        }
+        if (cfg->backend[0] == '\0' || cfg->n <= 0 || cfg->threads <= 0 || cfg->median <= 0.0) {
+            fprintf(stderr, "Malformed baseline line in %s\n", file);
+            exit(EXIT_FAILURE);
+        }
+        count++;
+    }
+    fclose(fin);
+    return count;
+}
+
+/*
+ * Checks that a baseline configuration was run the way this run is (same
+ * backend options and number of trials, and enough trials for a 95%
+ * interval), so that the two can be compared. Exits with a message if not.
+ */
+void check_baseline(const bench_config_t *cfg, const char *file)
+{
+    if (cfg->options != NULL && strcmp(cfg->options, backend_options) != 0) {
+        fprintf(stderr, "Baseline %s was run with backend options \"%s\", not \"%s\"\n",
+                file, cfg->options, backend_options);
+        exit(EXIT_FAILURE);
+    }
+    if (cfg->trials > 0 && cfg->trials < MIN_CI_TRIALS) {
+        fprintf(stderr, "Baseline %s has only %d trials per configuration; at least %d "
+                "are needed for a 95%% confidence interval\n", file, cfg->trials, MIN_CI_TRIALS);
+        exit(EXIT_FAILURE);
+    }
+    if (cfg->trials > 0 && cfg->trials != trials) {
+        fprintf(stderr, "Baseline %s was run with %d trials; rerun with -r %d\n",
+                file, cfg->trials, cfg->trials);
+        exit(EXIT_FAILURE);
+    }
+}
+
+/*
+ * Compares a configuration against its baseline. It counts as a regression
+ * only if the new confidence interval of the median lies entirely above the
+ * old one, by more than threshold percent of the old upper bound, so that
+ * run-to-run noise and negligible but statistically detectable changes do
+ * not fail the run. Returns true if it regressed.
+ */
+bool compare_baseline(const bench_config_t *cfg, const bench_stats_t *s, double threshold)
+{
+    double change = 100.0 * (s->median - cfg->median) / cfg->median;
+    if (s->ci_lo > cfg->ci_hi * (1.0 + threshold / 100.0)) {
+        fprintf(stderr, "REGRESSION  %-8s n=%-6d threads=%-3d median %.6fs -> %.6fs (%+.1f%%)\n",
+                s->backend, s->n, s->threads, cfg->median, s->median, change);
+        return true;
+    }
+    if (s->ci_hi < cfg->ci_lo * (1.0 - threshold / 100.0)) {
+        fprintf(stderr, "improvement %-8s n=%-6d threads=%-3d median %.6fs -> %.6fs (%+.1f%%)\n",
+                s->backend, s->n, s->threads, cfg->median, s->median, change);
+    }
+    return false;
+}
+
+void usage(const char *prog)
+{
+    fprintf(stderr, "Usage: %s [-P] [-B <backends>] [-n <sizes>] [-T <threads>] [-w <warmup>]\n"
+            "       [-r <trials>] [-f csv|json] [-o <file>] [-c <baseline.csv>] [-x <percent>]\n"
+            "       [-L <libdir>] [-- <backend options>]\n", prog);
+    exit(EXIT_FAILURE);
+}
+
+int main(int argc, char *argv[])
+{
+    char *backends[MAX_LIST];
+    int sizes[MAX_LIST];
+    int thread_counts[MAX_LIST];
+    int nbackends = parse_name_list("serial,openmp,pthread", backends);
+    int nsizes = parse_int_list("300,599,1197,2392", sizes);
+    int nthreads = parse_int_list("1,2,4,8", thread_counts);
+    bool json = false;
+    const char *out_file = NULL;
+    const char *baseline = NULL;
+    double threshold = 5.0;
+
+    int c;
+    while ((c = getopt(argc, argv, "B:c:f:L:n:o:Pr:T:w:x:")) != -1) {
+        switch (c) {
+        case 'B':
+            nbackends = parse_name_list(optarg, backends);
+            break;
+        case 'c':
+            baseline = optarg;
+            break;
+        case 'f':
+            if (strcmp(optarg, "json") == 0) {
+                json = true;
+            } else if (strcmp(optarg, "csv") != 0) {
+                usage(argv[0]);
+            }
+            break;
+        case 'L':
+            lib_dir = optarg;
+            break;
+        case 'n':
+            nsizes = parse_int_list(optarg, sizes);
+            break;
+        case 'o':
+            out_file = optarg;
+            break;
+        case 'P':
+            pin_mode = true;
+            break;
+        case 'r':
+            trials = (int)strtol(optarg, NULL, 10);
+            if (trials <= 0) {
+                fprintf(stderr, "Invalid number of trials: %s\n", optarg);
+                exit(EXIT_FAILURE);
+            }
+            break;
+        case 'T':
+            nthreads = parse_int_list(optarg, thread_counts);
+            break;
+        case 'w':
+            warmup = (int)strtol(optarg, NULL, 10);
+            if (warmup < 0) {
+                fprintf(stderr, "Invalid number of warmup runs: %s\n", optarg);
+                exit(EXIT_FAILURE);
+            }
+            break;
+        case 'x':
+            threshold = strtod(optarg, NULL);
+            if (threshold < 0.0) {
+                fprintf(stderr, "Invalid regression threshold: %s\n", optarg);
+                exit(EXIT_FAILURE);
+            }
+            break;
+        default:
+            usage(argv[0]);
+        }
+    }
+
+    // everything after "--" is passed on to the backends (and recorded in the
+    // results, which are comma-separated)
+    for (int i = optind; i < argc; i++) {
+        if (backend_argc == MAX_ARGS) {
+            usage(argv[0]);
+        }
+        if (strpbrk(argv[i], ",\"") != NULL ||
+                strlen(backend_options) + strlen(argv[i]) + 2 > sizeof(backend_options)) {
+            fprintf(stderr, "Invalid backend option: %s\n", argv[i]);
+            exit(EXIT_FAILURE);
+        }
+        if (backend_argc > 0) {
+            strcat(backend_options, " ");
+        }
+        strcat(backend_options, argv[i]);
+        backend_args[backend_argc++] = argv[i];
+        if (strcmp(argv[i], "-k") == 0 && i + 1 < argc) {
+            nrhs = (int)strtol(argv[i + 1], NULL, 10);
+        } else if (strncmp(argv[i], "-k", 2) == 0 && argv[i][2] != '\0') {
+            nrhs = (int)strtol(argv[i] + 2, NULL, 10);
+        }
+    }
+
+    // list the configurations: either those of the baseline or the full sweep
+    bench_config_t *configs = (bench_config_t *)calloc(MAX_LIST * MAX_LIST, sizeof(bench_config_t));
+    int nconfigs = 0;
+    if (trials < MIN_CI_TRIALS) {
+        if (baseline != NULL) {
+            fprintf(stderr, "At least %d trials (-r) are needed to compare against a baseline\n",
+                    MIN_CI_TRIALS);
+            exit(EXIT_FAILURE);
+        }
+        fprintf(stderr, "Warning: with fewer than %d trials the confidence interval of the "
+                "median covers it with less than 95%% probability\n", MIN_CI_TRIALS);
+    }
+    if (baseline != NULL) {
+        nconfigs = read_baseline(baseline, configs);
+        for (int i = 0; i < nconfigs; i++) {
+            check_baseline(&configs[i], baseline);
+        }
+        if (nconfigs > 0 && (configs[0].options == NULL || configs[0].trials == 0)) {
+            fprintf(stderr, "Warning: baseline %s doesn't record its backend options or "
+                    "trials; make sure they match this run\n", baseline);
+        }
+    } else {
+        for (int bi = 0; bi < nbackends; bi++) {
+            // the serial backend ignores the thread count, so run it only once
+            bool serial = strcmp(backends[bi], "serial") == 0;
+            for (int ti = 0; ti < (serial ? 1 : nthreads); ti++) {
+                for (int si = 0; si < nsizes; si++) {
+                    if (nconfigs == MAX_LIST * MAX_LIST) {
+                        fprintf(stderr, "Too many configurations\n");
+                        exit(EXIT_FAILURE);
+                    }
+                    bench_config_t *cfg = &configs[nconfigs++];
+                    snprintf(cfg->backend, sizeof(cfg->backend), "%s", backends[bi]);
+                    cfg->n = sizes[si];
+                    cfg->threads = serial ? 1 : thread_counts[ti];
+                }
+            }
+        }
+    }
+
+    FILE *fout = stdout;
+    if (out_file != NULL) {
+        fout = fopen(out_file, "w");
+        if (fout == NULL) {
+            fprintf(stderr, "Unable to open output file: %s\n", out_file);
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    if (json) {
+        fprintf(fout, "[\n");
+    } else {
+        write_csv_header(fout);
+    }
+
+    int failures = 0, regressions = 0;
+    bool first = true;
+    for (int i = 0; i < nconfigs; i++) {
+        bench_config_t *cfg = &configs[i];
+        bench_stats_t stats;
+        if (!run_config(cfg->backend, cfg->n, cfg->threads, &stats)) {
+            fprintf(stderr, "%s failed for n=%d threads=%d\n",
+                    cfg->backend, cfg->n, cfg->threads);
+            failures++;
+            continue;
+        }
+        if (json) {
+            write_json_row(fout, &stats, first);
+        } else {
+            write_csv_row(fout, &stats);
+        }
+        fflush(fout);
+        first = false;
+        if (baseline != NULL && compare_baseline(cfg, &stats, threshold)) {
+            regressions++;
+        }
+    }
+
+    if (json) {
+        fprintf(fout, "\n]\n");
+    }
+    if (fout != stdout) {
+        fclose(fout);
+    }
+    if (baseline != NULL) {
+        fprintf(stderr, "%d of %d configurations regressed\n", regressions, nconfigs);
+    }
+    for (int i = 0; i < nconfigs; i++) {
+        free(configs[i].options);
+    }
+    free(configs);
+    return failures > 0 || regressions > 0 ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,36 @@
+/**
+ * bench.h
+ *
+ * Interface between the benchmark driver (bench.cpp) and the CPU backends.
+ * Built with -DLIBRARY_BUILD, a backend is a shared library that exports
+ * bench_run() instead of main(): it takes the same command line as the
+ * program and, instead of printing the Nthreads=... line, fills in a
+ * bench_result_t. The libraries are built with -fvisibility=hidden, so their
+ * globals (n, A, b, ...) stay private and several backends can be loaded
+ * into the same process.
+ *
+ * Example:
+ *
+ *      bench_entry_t run = (bench_entry_t)dlsym(lib, BENCH_ENTRY);
+ *      char *args[] = { "serial", "1000", NULL };
+ *      bench_result_t r;
+ *      run(2, args, &r);
+ */
+
+#ifndef BENCH_H
+#define BENCH_H
+
+typedef struct {
+    int threads;        // number of threads used
+    double err;         // largest error in the solution
+    double init;        // phase times in seconds
+    double gaus;
+    double bsub;
+} bench_result_t;
+
+typedef int (*bench_entry_t)(int argc, char *argv[], bench_result_t *result);
+
+#define BENCH_ENTRY "bench_run"
+#define BENCH_EXPORT extern "C" __attribute__((visibility("default")))
+
+#endif  // BENCH_H
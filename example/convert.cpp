@@ -0,0 +1,115 @@
+/*
+ * convert.cpp
+ *
+ * Converts a linear system from the text augmented-matrix format read by the
+ * solvers into the binary format described in matrix_io.h, which the solvers
+ * can memory-map instead of parsing.
+ */
+
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "matrix_io.h"
+
+/*
+ * Writes count values as either floats or doubles.
+ */
+void write_values(FILE *fout, const double *vals, size_t count, bool single)
+{
+    size_t written;
+    if (single) {
+        float *tmp = (float*)malloc(sizeof(float) * count);
+        if (tmp == NULL) {
+            printf("Unable to allocate memory for conversion\n");
+            exit(EXIT_FAILURE);
+        }
+        for (size_t i = 0; i < count; i++) {
+            tmp[i] = (float)vals[i];
+        }
+        written = fwrite(tmp, sizeof(float), count, fout);
+        free(tmp);
+    } else {
+        written = fwrite(vals, sizeof(double), count, fout);
+    }
+    if (written != count) {
+        printf("Unable to write output file\n");
+        exit(EXIT_FAILURE);
+    }
+}
+
+/*
+ * Pads the output file with zeros up to the given offset.
+ */
+void pad_to(FILE *fout, uint64_t offset)
+{
+    long pos = ftell(fout);
+    while ((uint64_t)pos < offset) {
+        if (fputc(0, fout) == EOF) {
+            printf("Unable to write output file\n");
+            exit(EXIT_FAILURE);
+        }
+        pos++;
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    bool single = false;
+    int nrhs = 1;
+
+    int c;
+    while ((c = getopt(argc, argv, "fk:")) != -1) {
+        switch (c) {
+        case 'f':
+            single = true;
+            break;
+        case 'k':
+            nrhs = (int)strtol(optarg, NULL, 10);
+            if (nrhs <= 0) {
+                printf("Invalid number of right-hand sides: %s\n", optarg);
+                exit(EXIT_FAILURE);
+            }
+            break;
+        default:
+            printf("Usage: %s [-f] [-k <nrhs>] <input.txt> <output.bin>\n", argv[0]);
+            exit(EXIT_FAILURE);
+        }
+    }
+    if (optind != argc-2) {
+        printf("Usage: %s [-f] [-k <nrhs>] <input.txt> <output.bin>\n", argv[0]);
+        exit(EXIT_FAILURE);
+    }
+    const char *in_fn = argv[optind];
+    const char *out_fn = argv[optind+1];
+
+    // read text system (same parser as read_system() in the solvers)
+    int n;
+    double *A, *b;
+    matrix_read_text(in_fn, nrhs, (int)sysconf(_SC_NPROCESSORS_ONLN), &n, &A, &b);
+
+    // write header, then A and b at their aligned offsets
+    matrix_header_t h;
+    matrix_init_header(&h, n, nrhs, single ? sizeof(float) : sizeof(double));
+    FILE *fout = fopen(out_fn, "wb");
+    if (fout == NULL) {
+        printf("Unable to open file \"%s\"\n", out_fn);
+        exit(EXIT_FAILURE);
+    }
+    if (fwrite(&h, sizeof(h), 1, fout) != 1) {
+        printf("Unable to write output file\n");
+        exit(EXIT_FAILURE);
+    }
+    pad_to(fout, h.a_offset);
+    write_values(fout, A, (size_t)n*n, single);
+    pad_to(fout, h.b_offset);
+    write_values(fout, b, (size_t)n*nrhs, single);
+    if (fclose(fout) != 0) {
+        printf("Unable to write output file\n");
+        exit(EXIT_FAILURE);
+    }
+
+    free(A);
+    free(b);
+    return EXIT_SUCCESS;
+}
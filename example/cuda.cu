@@ -2,12 +2,19 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <getopt.h>
+#include <limits.h>
 #include <math.h>
 #include <string.h>
 #include <time.h>
 
+#include "matrix_io.h"
+#include "rng.h"
+
 #define REAL double
 
+// Mapping of A and b when the system was loaded from a binary file
+matrix_map_t mapped_system;
+
 // CUDA error check
 #define cudaCheckError() { \
     cudaError_t e=cudaGetLastError(); \
@@ -30,22 +37,20 @@ REAL find_max_error(REAL* x, int n) {
 
 // Function to allocate memory and initialize the matrix and vectors
 void generate_random_system(REAL** A, REAL** b, REAL** x, int n) {
-    // Seed the random number generator to get different results each time
-    srand(time(NULL));
-
     // Allocate memory for A, b, x
-    *A = new REAL[n * n];
-    *b = new REAL[n];
+    *A = (REAL*)malloc(sizeof(REAL) * n * n);
+    *b = (REAL*)malloc(sizeof(REAL) * n);
     *x = new REAL[n]; // This will be the solution vector; initialized later
 
-    // Fill the matrix A and vector b
+    // Fill the matrix A and vector b (same counter-based generator as the
+    // CPU versions, so every backend solves the same system)
     for (int i = 0; i < n; i++) {
         (*b)[i] = 0.0; // Initialize b[i] to zero for accumulation
         for (int j = 0; j < n; j++) {
             if (i == j) {
                 (*A)[i * n + j] = n / 10.0;
             } else {
-                (*A)[i * n + j] = (REAL)rand() / RAND_MAX; // Random double between 0.0 and 1.0
+                (*A)[i * n + j] = (REAL)rand_u31(RAND_SEED, i, j) / (REAL)ULONG_MAX;
             }
             (*b)[i] += (*A)[i * n + j];
         }
@@ -59,46 +64,18 @@ void generate_random_system(REAL** A, REAL** b, REAL** x, int n) {
 
 // Function to read matrix A and vector b from a file
 void read_system(const char* filename, REAL** A, REAL** b, REAL** x, int* n) {
-    FILE* file = fopen(filename, "r");
-    if (!file) {
-        fprintf(stderr, "Error opening file %s\n", filename);
-        exit(EXIT_FAILURE);
-    }
-
-    // Read the dimension of the matrix
-    if (fscanf(file, "%d", n) != 1) {
-        fprintf(stderr, "Invalid matrix file format\n");
-        fclose(file);
-        exit(EXIT_FAILURE);
-    }
-
-    // Allocate memory for A, b, x
-    *A = new REAL[*n * *n];
-    *b = new REAL[*n];
-    *x = new REAL[*n];
-
-    // Read the matrix A and vector b
-    for (int i = 0; i < *n; i++) {
-        for (int j = 0; j < *n; j++) {
-            if (fscanf(file, "%lf", &(*A)[i * *n + j]) != 1) {
-                fprintf(stderr, "Invalid matrix file format while reading A[%d][%d]\n", i, j);
-                fclose(file);
-                exit(EXIT_FAILURE);
-            }
-        }
-        if (fscanf(file, "%lf", &(*b)[i]) != 1) {
-            fprintf(stderr, "Invalid matrix file format while reading b[%d]\n", i);
-            fclose(file);
-            exit(EXIT_FAILURE);
-        }
+    // Binary files (see matrix_io.h) are mapped and used in place
+    if (matrix_map(filename, 1, sizeof(REAL), &mapped_system)) {
+        *n = mapped_system.n;
+        *A = (REAL*)mapped_system.A;
+        *b = (REAL*)mapped_system.b;
+        *x = new REAL[*n]();
+        return;
     }
 
-    // Optionally initialize x to some default values (e.g., zeros)
-    for (int i = 0; i < *n; i++) {
-        (*x)[i] = 0.0; // Initialize solution vector to zero
-    }
-
-    fclose(file);
+    // Parse the text file with one thread per online CPU
+    matrix_read_text(filename, 1, (int)sysconf(_SC_NPROCESSORS_ONLN), n, A, b);
+    *x = new REAL[*n](); // Initialize solution vector to zero
 }
 
 __device__ double atomicAddDouble(double* address, double val) {
@@ -280,8 +257,12 @@ int main(int argc, char *argv[]) {
     cudaFree(d_A);
     cudaFree(d_b);
     cudaFree(d_x);
-    delete[] A;
-    delete[] b;
+    if (mapped_system.base != NULL) {
+        matrix_unmap(&mapped_system);
+    } else {
+        free(A);
+        free(b);
+    }
     delete[] x;
 
     return EXIT_SUCCESS;
@@ -0,0 +1,185 @@
+/**
+ * matrix_alloc.h
+ *
+ * Allocator for the coefficient matrix A.
+ *
+ * Rows are stored lda >= n elements apart (the leading dimension). lda is
+ * rounded up to whole 64-byte cache lines, so every row starts on a line,
+ * and then to an odd number of lines. With a stride of an even number of
+ * lines (e.g. n a multiple of 512) the same column of successive rows maps
+ * to only a few cache sets, and walking down a column or updating a block of
+ * rows evicts itself; with an odd stride successive rows cycle through all
+ * the sets.
+ *
+ * Large matrices are backed by huge pages to cut TLB misses: explicit huge
+ * pages (MAP_HUGETLB) if the administrator has reserved some, otherwise
+ * transparent huge pages requested with madvise(MADV_HUGEPAGE) on a 2 MB
+ * aligned mapping. The memory is zero-filled and not touched until first
+ * written (the length of each mapping is kept in a small table, not in the
+ * mapping), so NUMA first-touch placement still works (see placement.h).
+ * Allocate and free from one thread at a time.
+ *
+ * Example:
+ *
+ *      lda = matrix_lda(n, sizeof(REAL));
+ *      A = (REAL*)matrix_alloc((size_t)n*lda*sizeof(REAL));
+ *      A[row*lda + col] = ...;
+ *      matrix_free(A);
+ *
+ * or, for a std::vector, std::vector<REAL, matrix_allocator<REAL>> A.
+ */
+
+#ifndef MATRIX_ALLOC_H
+#define MATRIX_ALLOC_H
+
+#include <new>
+#include <stdint.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#define MATRIX_LINE         64
+#define MATRIX_HUGE_PAGE    (2UL << 20)
+
+// maximum number of live allocations
+#define MATRIX_MAX_ALLOCS   32
+
+// live mappings, so matrix_free() knows their lengths (free entries have
+// base == NULL)
+typedef struct {
+    void   *base;       // start of the mapping (the returned pointer)
+    size_t  len;        // length of the mapping
+} matrix_alloc_entry_t;
+
+static matrix_alloc_entry_t matrix_allocs[MATRIX_MAX_ALLOCS];
+
+/*
+ * Returns the leading dimension for an n x n matrix of elem_size values:
+ * n rounded up to an odd number of cache lines.
+ */
+static inline int matrix_lda(int n, size_t elem_size)
+{
+    size_t per_line = MATRIX_LINE / elem_size;
+    size_t lines = ((size_t)n + per_line - 1) / per_line;
+    if (lines % 2 == 0) {
+        lines++;
+    }
+    return (int)(lines * per_line);
+}
+
+/*
+ * Allocates bytes of zero-filled, cache-line aligned memory, backed by huge
+ * pages if it is large enough. Release with matrix_free(). Returns NULL on
+ * failure.
+ */
+static inline void *matrix_alloc(size_t bytes)
+{
+    matrix_alloc_entry_t *entry = NULL;
+    for (int i = 0; i < MATRIX_MAX_ALLOCS && entry == NULL; i++) {
+        if (matrix_allocs[i].base == NULL) {
+            entry = &matrix_allocs[i];
+        }
+    }
+    if (entry == NULL) {
+        return NULL;
+    }
+
+    size_t page = (size_t)sysconf(_SC_PAGESIZE);
+    size_t len = (bytes > 0) ? bytes : 1;
+    char *base = (char *)MAP_FAILED;
+
+    if (len >= MATRIX_HUGE_PAGE) {
+        // explicit huge pages (fails unless some are reserved)
+#       ifdef MAP_HUGETLB
+        size_t huge_len = (len + MATRIX_HUGE_PAGE - 1) / MATRIX_HUGE_PAGE * MATRIX_HUGE_PAGE;
+        base = (char *)mmap(NULL, huge_len, PROT_READ | PROT_WRITE,
+                MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        if (base != (char *)MAP_FAILED) {
+            len = huge_len;
+        }
+#       endif
+
+        // transparent huge pages: map with room to align the start to a
+        // huge page boundary and trim the rest
+        if (base == (char *)MAP_FAILED) {
+            len = (len + page - 1) / page * page;
+            size_t slack = MATRIX_HUGE_PAGE;
+            char *raw = (char *)mmap(NULL, len + slack, PROT_READ | PROT_WRITE,
+                    MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+            if (raw == (char *)MAP_FAILED) {
+                return NULL;
+            }
+            base = (char *)(((uintptr_t)raw + MATRIX_HUGE_PAGE - 1) & ~(MATRIX_HUGE_PAGE - 1));
+            if (base > raw) {
+                munmap(raw, base - raw);
+            }
+            if (raw + len + slack > base + len) {
+                munmap(base + len, raw + len + slack - (base + len));
+            }
+#           ifdef MADV_HUGEPAGE
+            madvise(base, len, MADV_HUGEPAGE);
+#           endif
+        }
+    } else {
+        len = (len + page - 1) / page * page;
+        base = (char *)mmap(NULL, len, PROT_READ | PROT_WRITE,
+                MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (base == (char *)MAP_FAILED) {
+            return NULL;
+        }
+    }
+
+    entry->base = base;
+    entry->len = len;
+    return base;
+}
+
+/*
+ * Releases memory from matrix_alloc() (NULL is ignored).
+ */
+static inline void matrix_free(void *ptr)
+{
+    if (ptr == NULL) {
+        return;
+    }
+    for (int i = 0; i < MATRIX_MAX_ALLOCS; i++) {
+        if (matrix_allocs[i].base == ptr) {
+            munmap(ptr, matrix_allocs[i].len);
+            matrix_allocs[i].base = NULL;
+            return;
+        }
+    }
+}
+
+/*
+ * Standard allocator on top of matrix_alloc(), for use with std::vector.
+ */
+template <typename T>
+struct matrix_allocator {
+    typedef T value_type;
+
+    matrix_allocator() {}
+    template <typename U>
+    matrix_allocator(const matrix_allocator<U> &) {}
+
+    T *allocate(size_t count)
+    {
+        T *ptr = (T *)matrix_alloc(count * sizeof(T));
+        if (ptr == NULL) {
+            throw std::bad_alloc();
+        }
+        return ptr;
+    }
+
+    void deallocate(T *ptr, size_t)
+    {
+        matrix_free(ptr);
+    }
+};
+
+template <typename T, typename U>
+bool operator==(const matrix_allocator<T> &, const matrix_allocator<U> &) { return true; }
+template <typename T, typename U>
+bool operator!=(const matrix_allocator<T> &, const matrix_allocator<U> &) { return false; }
+
+#endif  // MATRIX_ALLOC_H
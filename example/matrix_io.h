@@ -0,0 +1,528 @@
+/**
+ * matrix_io.h
+ *
+ * Loaders for linear systems stored as augmented matrices [A][b].
+ *
+ * Text format: n on the first line, then one row per line holding n entries
+ * of A followed by nrhs entries of b. matrix_read_text() maps the file, splits
+ * it into chunks at line boundaries and parses the chunks in parallel with a
+ * locale-free number parser, writing each row straight into A and b.
+ *
+ * Binary format: parsing text costs one conversion per value, which dominates
+ * INIT for large n; a binary file is instead mapped straight into memory and
+ * A and b point into the mapping (no parsing and no copy).
+ *
+ * Layout (all fields in the byte order of the machine that wrote the file):
+ *
+ *      offset 0        matrix_header_t
+ *      a_offset        A: n x n values, row-major
+ *      b_offset        b: n x nrhs values, row-major
+ *
+ * Both offsets are multiples of MATRIX_ALIGN (the page size), so A and b can
+ * be used in place by the solvers. The mapping is private (copy-on-write):
+ * elimination modifies A and b in memory without touching the file.
+ *
+ * Use the "convert" program to create binary files from the text format.
+ *
+ * Example:
+ *
+ *      matrix_map_t m;
+ *      if (matrix_map(fn, nrhs, sizeof(REAL), &m)) {
+ *          n = m.n;  A = (REAL*)m.A;  b = (REAL*)m.b;
+ *      }
+ *      ...
+ *      matrix_unmap(&m);
+ */
+
+#ifndef MATRIX_IO_H
+#define MATRIX_IO_H
+
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "matrix_alloc.h"
+
+#define MATRIX_MAGIC    "GAUSSMAT"
+#define MATRIX_VERSION  1
+#define MATRIX_ENDIAN   0x01020304u     // reads back as 0x04030201 if swapped
+#define MATRIX_ALIGN    4096
+
+typedef struct {
+    char     magic[8];          // MATRIX_MAGIC (not NUL-terminated)
+    uint32_t version;           // MATRIX_VERSION
+    uint32_t endian;            // MATRIX_ENDIAN as written by the producer
+    uint32_t elem_size;         // 4 (float) or 8 (double)
+    uint32_t n;                 // rows/columns of A
+    uint32_t nrhs;              // columns of b
+    uint32_t reserved;
+    uint64_t a_offset;          // byte offset of A (multiple of MATRIX_ALIGN)
+    uint64_t b_offset;          // byte offset of b (multiple of MATRIX_ALIGN)
+} matrix_header_t;
+
+typedef struct {
+    void  *base;                // start of the mapping (NULL if unmapped)
+    size_t length;              // length of the mapping
+    int    n;
+    int    nrhs;
+    void  *A;
+    void  *b;
+} matrix_map_t;
+
+/*
+ * Fills in a header for an n x n system with nrhs right-hand sides, laying
+ * out A and b on MATRIX_ALIGN boundaries.
+ */
+static inline void matrix_init_header(matrix_header_t *h, int n, int nrhs, size_t elem_size)
+{
+    memset(h, 0, sizeof(*h));
+    memcpy(h->magic, MATRIX_MAGIC, sizeof(h->magic));
+    h->version = MATRIX_VERSION;
+    h->endian = MATRIX_ENDIAN;
+    h->elem_size = (uint32_t)elem_size;
+    h->n = (uint32_t)n;
+    h->nrhs = (uint32_t)nrhs;
+    h->a_offset = MATRIX_ALIGN;
+    uint64_t a_end = h->a_offset + (uint64_t)n * n * elem_size;
+    h->b_offset = (a_end + MATRIX_ALIGN - 1) / MATRIX_ALIGN * MATRIX_ALIGN;
+}
+
+/*
+ * Maps a binary matrix file. Returns false (without printing anything) if
+ * the file is not in the binary format, so the caller can fall back to the
+ * text parser; prints a message and exits if it is a binary file that can't
+ * be used (wrong element type, byte order or number of right-hand sides).
+ */
+static inline bool matrix_map(const char *fn, int nrhs, size_t elem_size, matrix_map_t *m)
+{
+    memset(m, 0, sizeof(*m));
+
+    int fd = open(fn, O_RDONLY);
+    if (fd < 0) {
+        return false;
+    }
+    matrix_header_t h;
+    struct stat st;
+    if (pread(fd, &h, sizeof(h), 0) != (ssize_t)sizeof(h) ||
+            memcmp(h.magic, MATRIX_MAGIC, sizeof(h.magic)) != 0 ||
+            fstat(fd, &st) != 0) {
+        close(fd);
+        return false;
+    }
+
+    if (h.endian != MATRIX_ENDIAN) {
+        printf("Matrix file \"%s\" has the wrong byte order for this machine\n", fn);
+        exit(EXIT_FAILURE);
+    }
+    if (h.version != MATRIX_VERSION || h.elem_size != elem_size) {
+        printf("Matrix file \"%s\" holds %u-byte values (expected %zu-byte values)\n",
+                fn, h.elem_size, elem_size);
+        exit(EXIT_FAILURE);
+    }
+    if ((int)h.nrhs != nrhs) {
+        printf("Matrix file \"%s\" has %u right-hand sides (use -k %u)\n",
+                fn, h.nrhs, h.nrhs);
+        exit(EXIT_FAILURE);
+    }
+    uint64_t b_end = h.b_offset + (uint64_t)h.n * h.nrhs * elem_size;
+    if (h.n == 0 || h.a_offset % MATRIX_ALIGN != 0 || h.b_offset % MATRIX_ALIGN != 0 ||
+            h.a_offset + (uint64_t)h.n * h.n * elem_size > h.b_offset ||
+            b_end > (uint64_t)st.st_size) {
+        printf("Invalid matrix file format\n");
+        exit(EXIT_FAILURE);
+    }
+
+    // private writable mapping: the solver updates A and b in place and the
+    // modified pages are copied on first write
+    void *base = mmap(NULL, (size_t)b_end, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (base == MAP_FAILED) {
+        printf("Unable to map matrix file \"%s\"\n", fn);
+        exit(EXIT_FAILURE);
+    }
+
+    // hints only (failures are harmless): start reading ahead now, and back
+    // the copied-on-write pages of A with huge pages where possible
+    madvise(base, (size_t)b_end, MADV_SEQUENTIAL);
+    madvise(base, (size_t)b_end, MADV_WILLNEED);
+#   ifdef MADV_HUGEPAGE
+    madvise(base, (size_t)b_end, MADV_HUGEPAGE);
+#   endif
+
+    m->base = base;
+    m->length = (size_t)b_end;
+    m->n = (int)h.n;
+    m->nrhs = (int)h.nrhs;
+    m->A = (char*)base + h.a_offset;
+    m->b = (char*)base + h.b_offset;
+    return true;
+}
+
+/*
+ * Releases a mapping created by matrix_map() (no-op if nothing is mapped).
+ */
+static inline void matrix_unmap(matrix_map_t *m)
+{
+    if (m->base != NULL) {
+        munmap(m->base, m->length);
+        m->base = NULL;
+    }
+}
+
+/*
+ * Parses one floating-point value starting at p (no leading whitespace) and
+ * returns a pointer just past it, or NULL if there is no number at p. Values
+ * with at most 19 significant digits and a small exponent are exact in double
+ * arithmetic and converted directly; anything else (long mantissas, large
+ * exponents, inf/nan, hex) is handed to strtod(), so the result always
+ * matches what fscanf("%lf") would produce.
+ */
+static inline const char *matrix_parse_value(const char *p, const char *end, double *val)
+{
+    static const double pow10[] = {
+        1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,  1e8,  1e9,  1e10, 1e11,
+        1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+    };
+
+    const char *s = p;
+    bool neg = false;
+    if (s < end && (*s == '-' || *s == '+')) {
+        neg = (*s == '-');
+        s++;
+    }
+    uint64_t mant = 0;
+    int sig_digits = 0, exp10 = 0;
+    bool any_digits = false, exact = true;
+    while (s < end && *s >= '0' && *s <= '9') {
+        any_digits = true;
+        if (sig_digits < 19) {
+            mant = mant * 10 + (uint64_t)(*s - '0');
+            sig_digits += (mant != 0);
+        } else {
+            exact = false;
+        }
+        s++;
+    }
+    if (s < end && *s == '.') {
+        s++;
+        while (s < end && *s >= '0' && *s <= '9') {
+            any_digits = true;
+            if (sig_digits < 19) {
+                mant = mant * 10 + (uint64_t)(*s - '0');
+                sig_digits += (mant != 0);
+                exp10--;
+            } else {
+                exact = false;
+            }
+            s++;
+        }
+    }
+    if (any_digits && s < end && (*s == 'e' || *s == 'E')) {
+        const char *e = s + 1;
+        bool eneg = false;
+        if (e < end && (*e == '-' || *e == '+')) {
+            eneg = (*e == '-');
+            e++;
+        }
+        if (e < end && *e >= '0' && *e <= '9') {
+            int ev = 0;
+            while (e < end && *e >= '0' && *e <= '9') {
+                if (ev < 100000) {
+                    ev = ev * 10 + (*e - '0');
+                }
+                e++;
+            }
+            exp10 += eneg ? -ev : ev;
+            s = e;
+        } else {
+            exact = false;      // let strtod decide what "1e" means
+        }
+    }
+
+    // fast path: both operands exact in double, so one correctly rounded
+    // multiply or divide gives the correctly rounded result
+    if (any_digits && exact && mant <= (1ULL << 53) && exp10 >= -22 && exp10 <= 22 &&
+            (s == end || (*s != 'x' && *s != 'X'))) {
+        double v = (double)mant;
+        v = (exp10 < 0) ? v / pow10[-exp10] : v * pow10[exp10];
+        *val = neg ? -v : v;
+        return s;
+    }
+
+    // slow path: copy the token (the mapping is not NUL-terminated)
+    char buf[128];
+    size_t len = 0;
+    while (p + len < end && len < sizeof(buf) - 1 &&
+            p[len] != ' ' && p[len] != '\t' && p[len] != '\n' && p[len] != '\r' &&
+            p[len] != '\v' && p[len] != '\f') {
+        len++;
+    }
+    memcpy(buf, p, len);
+    buf[len] = '\0';
+    char *stop;
+    *val = strtod(buf, &stop);
+    return (stop == buf) ? NULL : p + (stop - buf);
+}
+
+static inline bool matrix_is_space(char c)
+{
+    return c == ' ' || c == '\t' || c == '\n' || c == '\r' || c == '\v' || c == '\f';
+}
+
+/*
+ * Work for one text-parsing thread: a chunk of whole lines, the index of the
+ * first row it holds, and where to store the values.
+ */
+template <typename T>
+struct matrix_text_chunk_t {
+    const char *begin;
+    const char *end;
+    int         n;
+    int         lda;            // row stride of A
+    int         nrhs;
+    long        rows;           // pass 1: number of non-blank lines
+    long        first_row;      // pass 2: row index of the first line
+    T          *A;
+    T          *b;
+    bool        ok;             // pass 2: every line held exactly n+nrhs values
+};
+
+/*
+ * Pass 1: counts the non-blank lines in a chunk.
+ */
+template <typename T>
+static void *matrix_text_count(void *arg)
+{
+    matrix_text_chunk_t<T> *c = (matrix_text_chunk_t<T> *)arg;
+    long rows = 0;
+    bool blank = true;
+    for (const char *p = c->begin; p < c->end; p++) {
+        if (*p == '\n') {
+            rows += !blank;
+            blank = true;
+        } else if (!matrix_is_space(*p)) {
+            blank = false;
+        }
+    }
+    c->rows = rows + !blank;
+    return NULL;
+}
+
+/*
+ * Pass 2: parses the lines of a chunk into rows first_row, first_row+1, ...
+ * Stops with ok = false at the first line that doesn't hold exactly n+nrhs
+ * values (values may not continue onto the next line here).
+ */
+template <typename T>
+static void *matrix_text_parse(void *arg)
+{
+    matrix_text_chunk_t<T> *c = (matrix_text_chunk_t<T> *)arg;
+    const int n = c->n, lda = c->lda, nrhs = c->nrhs;
+    const char *p = c->begin, *end = c->end;
+    long row = c->first_row;
+    c->ok = true;
+    while (p < end) {
+        while (p < end && *p != '\n' && matrix_is_space(*p)) {
+            p++;
+        }
+        if (p == end) {
+            break;
+        }
+        if (*p == '\n') {
+            p++;                // blank line
+            continue;
+        }
+        for (int col = 0; col < n + nrhs; col++) {
+            while (p < end && *p != '\n' && matrix_is_space(*p)) {
+                p++;
+            }
+            double v;
+            if (p == end || *p == '\n' ||
+                    (p = matrix_parse_value(p, end, &v)) == NULL) {
+                c->ok = false;
+                return NULL;
+            }
+            if (col < n) {
+                c->A[row*lda + col] = (T)v;
+            } else {
+                c->b[row*nrhs + col - n] = (T)v;
+            }
+        }
+        while (p < end && *p != '\n') {
+            if (!matrix_is_space(*p)) {
+                c->ok = false;  // extra values on the line
+                return NULL;
+            }
+            p++;
+        }
+        row++;
+    }
+    return NULL;
+}
+
+/*
+ * Runs func on every chunk, using one thread per chunk (chunk 0 runs on the
+ * calling thread).
+ */
+template <typename T>
+static void matrix_text_run(void *(*func)(void *), matrix_text_chunk_t<T> *chunks, int nchunks)
+{
+    pthread_t *threads = (pthread_t *)malloc(sizeof(pthread_t) * nchunks);
+    for (int t = 1; t < nchunks; t++) {
+        if (pthread_create(&threads[t], NULL, func, &chunks[t]) != 0) {
+            printf("Unable to create parser thread\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+    func(&chunks[0]);
+    for (int t = 1; t < nchunks; t++) {
+        pthread_join(threads[t], NULL);
+    }
+    free(threads);
+}
+
+/*
+ * Reads a text system with nthreads parser threads, allocating A (n x n) and b
+ * (n x nrhs) with malloc(). If lda_out is given, A is instead allocated with
+ * matrix_alloc() (release it with matrix_free()) and its rows padded to the
+ * leading dimension matrix_lda(n), which is stored in *lda_out. Files laid out
+ * one row per line are split into nthreads chunks at line boundaries and parsed
+ * in parallel; anything else (e.g. rows wrapped over several lines) is parsed
+ * sequentially as a stream of whitespace-separated values, exactly like the
+ * fscanf() loop it replaces. Prints "Invalid matrix file format" and exits on
+ * malformed input.
+ */
+template <typename T>
+static void matrix_read_text(const char *fn, int nrhs, int nthreads, int *n_out,
+        T **A_out, T **b_out, int *lda_out = NULL)
+{
+    int fd = open(fn, O_RDONLY);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) != 0) {
+        printf("Unable to open file \"%s\"\n", fn);
+        exit(EXIT_FAILURE);
+    }
+    size_t size = (size_t)st.st_size;
+    const char *data = NULL;
+    if (size > 0) {
+        data = (const char *)mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (data == (const char *)MAP_FAILED) {
+            printf("Unable to map file \"%s\"\n", fn);
+            exit(EXIT_FAILURE);
+        }
+        madvise((void *)data, size, MADV_SEQUENTIAL);
+        madvise((void *)data, size, MADV_WILLNEED);
+    }
+    close(fd);
+    const char *end = data + size;
+
+    // matrix dimension
+    const char *p = data;
+    while (p < end && matrix_is_space(*p)) {
+        p++;
+    }
+    long n = 0;
+    const char *digits = p;
+    while (p < end && *p >= '0' && *p <= '9' && n <= INT_MAX) {
+        n = n * 10 + (*p++ - '0');
+    }
+    if (p == digits || n == 0 || n > INT_MAX) {
+        printf("Invalid matrix file format\n");
+        exit(EXIT_FAILURE);
+    }
+
+    long lda = (lda_out != NULL) ? matrix_lda((int)n, sizeof(T)) : n;
+    T *A = (lda_out != NULL) ? (T *)matrix_alloc(sizeof(T) * (size_t)n*lda)
+                             : (T *)malloc(sizeof(T) * (size_t)n*n);
+    T *b = (T *)malloc(sizeof(T) * (size_t)n*nrhs);
+    if (A == NULL || b == NULL) {
+        printf("Unable to allocate memory for linear system\n");
+        exit(EXIT_FAILURE);
+    }
+
+    // split the body into chunks of whole lines
+    if (nthreads < 1) {
+        nthreads = 1;
+    }
+    if ((size_t)nthreads > size / 4096 + 1) {
+        nthreads = (int)(size / 4096 + 1);   // not worth a thread per few rows
+    }
+    matrix_text_chunk_t<T> *chunks =
+        (matrix_text_chunk_t<T> *)malloc(sizeof(matrix_text_chunk_t<T>) * nthreads);
+    const char *start = p;
+    for (int t = 0; t < nthreads; t++) {
+        const char *stop = (t == nthreads-1) ? end :
+            p + (size_t)(end - p) * (t+1) / nthreads;
+        if (stop < start) {
+            stop = start;
+        }
+        const char *nl = (stop < end) ? (const char *)memchr(stop, '\n', end - stop) : NULL;
+        stop = (t == nthreads-1 || nl == NULL) ? end : nl + 1;
+        chunks[t].begin = start;
+        chunks[t].end = stop;
+        chunks[t].n = n;
+        chunks[t].lda = lda;
+        chunks[t].nrhs = nrhs;
+        chunks[t].A = A;
+        chunks[t].b = b;
+        start = stop;
+    }
+
+    // pass 1: count rows per chunk to find where each chunk's rows start
+    matrix_text_run<T>(matrix_text_count<T>, chunks, nthreads);
+    long rows = 0;
+    for (int t = 0; t < nthreads; t++) {
+        chunks[t].first_row = rows;
+        rows += chunks[t].rows;
+    }
+
+    // pass 2: parse the chunks in parallel
+    bool ok = false;
+    if (rows == n) {
+        matrix_text_run<T>(matrix_text_parse<T>, chunks, nthreads);
+        ok = true;
+        for (int t = 0; t < nthreads; t++) {
+            ok = ok && chunks[t].ok;
+        }
+    }
+
+    // not one row per line: read the values as one whitespace-separated stream
+    if (!ok) {
+        for (long i = 0; i < (long)n*(n+nrhs); i++) {
+            while (p < end && matrix_is_space(*p)) {
+                p++;
+            }
+            double v;
+            if (p == end || (p = matrix_parse_value(p, end, &v)) == NULL) {
+                printf("Invalid matrix file format\n");
+                exit(EXIT_FAILURE);
+            }
+            long row = i / (n+nrhs), col = i % (n+nrhs);
+            if (col < n) {
+                A[row*lda + col] = (T)v;
+            } else {
+                b[row*nrhs + col - n] = (T)v;
+            }
+        }
+    }
+
+    free(chunks);
+    if (data != NULL) {
+        munmap((void *)data, size);
+    }
+    *n_out = (int)n;
+    if (lda_out != NULL) {
+        *lda_out = (int)lda;
+    }
+    *A_out = A;
+    *b_out = b;
+}
+
+#endif  // MATRIX_IO_H
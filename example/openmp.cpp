@@ -17,6 +17,7 @@ We did not use it to write any code.
 // Link to our analysis:
 // https://drive.google.com/file/d/11FrjxVnWL15svM3BUKHFGyRP6pJNmEYD/view?usp=sharing
 
+#include <float.h>
 #include <getopt.h>
 #include <limits.h>
 #include <math.h>
@@ -33,33 +34,127 @@ We did not use it to write any code.
 // custom timing macros
 #include "timer.h"
 
+// vectorized row update and dot product kernels
+#include "simd.h"
+
+// binary (memory-mapped) matrix file format
+#include "matrix_io.h"
+
+// counter-based random numbers for generated systems
+#include "rng.h"
+
+// entry point for the benchmark driver (library builds)
+#include "bench.h"
+
+// NUMA-aware allocation and thread pinning
+#include "placement.h"
+
 // uncomment this line to enable the alternative back substitution method
-#define USE_COLUMN_BACKSUB
+/*#define USE_COLUMN_BACKSUB*/
 
 // use 64-bit IEEE arithmetic (change to "float" to use 32-bit arithmetic)
 #define REAL double
 
-// linear system: Ax = b    (A is n x n matrix; b and x are n x 1 vectors)
+// linear system: Ax = b    (A is n x n matrix; b and x are n x nrhs matrices
+// stored row-major, one column per right-hand side)
 int n;
+int nrhs = 1;
 REAL *A;
+int lda;    // leading dimension (row stride) of A, padded (see matrix_alloc.h)
 REAL *x;
 REAL *b;
 
+// mapping of A and b when the system was loaded from a binary file
+matrix_map_t mapped_system;
+
+// row permutation from partial pivoting: logical row i of A and b is stored
+// in physical row perm[i] (identity unless pivoting is enabled)
+int *perm;
+
 // enable/disable debugging output (don't enable for large matrix sizes!)
 bool debug_mode = false;
 
 // enable/disable triangular mode (to skip the Gaussian elimination phase)
 bool triangular_mode = false;
 
+// enable/disable partial pivoting
+bool pivot_mode = false;
+
+// enable/disable fused generate-and-eliminate mode (random systems only)
+bool fused_mode = false;
+
+// enable/disable mixed precision (factor in float, refine the solution in
+// double)
+bool mixed_mode = false;
+
+// single precision copy of A factored in mixed mode (rows ldf apart, same
+// row permutation), and the number of refinement steps it took
+float *Af;
+int ldf;
+int refine_iters = 0;
+
+// maximum number of iterative refinement steps per right-hand side
+#define REFINE_MAX_ITERS 10
+
+// first pivot left for Gaussian elimination (1 if the first pivot was already
+// eliminated while the system was generated)
+int first_pivot = 0;
+
+// candidate pivot (magnitude and logical row) for the parallel pivot search
+typedef struct {
+    REAL val;
+    int row;
+} pivot_t;
+
+// keep the larger magnitude, breaking ties towards the lower row so that the
+// chosen pivot doesn't depend on the number of threads
+#pragma omp declare reduction(maxabs : pivot_t :\
+        omp_out = (omp_in.val > omp_out.val ||\
+                   (omp_in.val == omp_out.val && omp_in.row < omp_out.row))\
+                  ? omp_in : omp_out)\
+    initializer(omp_priv = omp_orig)
+
+// pin each thread to its own CPU
+bool pin_mode = false;
+
+// interleave A over all NUMA nodes instead of placing it by first touch
+bool interleave_mode = false;
+
+// true if the system was read from a file (A keeps the placement of the loader)
+bool loaded_system = false;
+
+// panel width for blocked Gaussian elimination (0 = unblocked elimination)
+int block_size = 0;
+
+// tile dimensions for the trailing matrix update in blocked elimination
+#define TILE_ROWS 64
+#define TILE_COLS 256
+
+// enable/disable tiled elimination as a graph of OpenMP tasks
+bool task_mode = false;
+
+// tile size for the task graph if no panel width is given with -b
+#define TASK_BLOCK 128
+
+// rows per diagonal block in the blocked back substitution
+#define BSUB_BLOCK 64
+
+// pivots per block in the elimination profile (see timer.h)
+#define PROFILE_BLOCK 64
+
 /*
- * Generate a random linear system of size n.
+ * Allocates (zero-filled) space for a generated system, with A's rows padded
+ * to the leading dimension lda. A is cleared in parallel with the same static
+ * row distribution as the first pivot of gaussian_elimination(), so each
+ * row's pages are first touched (and placed on the NUMA node of) the thread
+ * that will update it.
  */
-void rand_system()
+void alloc_system()
 {
-    // allocate space for matrices
-    A = (REAL*)calloc(n*n, sizeof(REAL));
-    b = (REAL*)calloc(n,   sizeof(REAL));
-    x = (REAL*)calloc(n,   sizeof(REAL));
+    lda = matrix_lda(n, sizeof(REAL));
+    A = (REAL*)placement_alloc((size_t)n*lda*sizeof(REAL), interleave_mode);
+    b = (REAL*)calloc(n*nrhs, sizeof(REAL));
+    x = (REAL*)calloc(n*nrhs, sizeof(REAL));
 
     // verify that memory allocation succeeded
     if (A == NULL || b == NULL || x == NULL) {
@@ -67,118 +162,555 @@ void rand_system()
         exit(EXIT_FAILURE);
     }
 
-    // initialize pseudorandom number generator
-    // (see https://en.wikipedia.org/wiki/Linear_congruential_generator)
-    unsigned long seed = 0;
-
-    // generate random matrix entries
-#   pragma omp parallel for default(none)\
-        shared(n, A, triangular_mode, seed)
+#   pragma omp parallel for schedule(static) default(none) shared(A, lda, n)
     for (int row = 0; row < n; row++) {
-        int col = triangular_mode ? row : 0;
-        for (; col < n; col++) {
-            if (row != col) {
-                seed = (1103515245*seed + 12345) % (1<<31);
-                A[row*n + col] = (REAL)seed / (REAL)ULONG_MAX;
-            } else {
-                A[row*n + col] = n/10.0;
-            }
-        }
+        memset(&A[(size_t)row*lda], 0, lda*sizeof(REAL));
     }
+}
 
-    // generate right-hand side such that the solution matrix is all 1s
-#   pragma omp parallel for default(none)\
-        shared(n, A, b)
+/*
+ * Pins every OpenMP thread to its own CPU (see placement.h). The runtime
+ * keeps the same threads for later parallel regions of the same size.
+ */
+void pin_threads()
+{
+    placement_init();
+#   pragma omp parallel default(none)
+    {
+        placement_pin(omp_get_thread_num());
+    }
+}
+
+/*
+ * Returns entry (row, col) of the random matrix. Each entry is a function of
+ * its row and column only, so rows can be generated in parallel and every
+ * backend and thread count generates the same system.
+ */
+REAL rand_entry(int row, int col)
+{
+    if (row == col) {
+        return n/10.0;
+    }
+    return (REAL)rand_u31(RAND_SEED, row, col) / (REAL)ULONG_MAX;
+}
+
+/*
+ * Generates one row of the random system: the entries of A and right-hand
+ * sides such that column j of the solution is all (j+1)s.
+ */
+void rand_row(int row)
+{
+    int col = triangular_mode ? row : 0;
+    for (; col < n; col++) {
+        A[row*lda + col] = rand_entry(row, col);
+    }
+    REAL sum = 0.0;
+    for (int col = 0; col < n; col++) {
+        sum += A[row*lda + col] * 1.0;
+    }
+    for (int j = 0; j < nrhs; j++) {
+        b[row*nrhs + j] = sum * (j+1);
+    }
+}
+
+/*
+ * Generate a random linear system of size n.
+ */
+void rand_system()
+{
+    alloc_system();
+
+#   pragma omp parallel for schedule(static) default(none) shared(n)
     for (int row = 0; row < n; row++) {
-        b[row] = 0.0;
-        for (int col = 0; col < n; col++) {
-            b[row] += A[row*n + col] * 1.0;
-        }
+        rand_row(row);
     }
 }
 
 /*
  * Reads a linear system of equations from a file in the form of an augmented
- * matrix [A][b].
+ * matrix [A][b] (each row holds n entries of A followed by nrhs entries of b),
+ * or maps it from a file in the binary format (see matrix_io.h).
  */
 void read_system(const char *fn)
 {
-    // open file and read matrix dimensions
-    FILE* fin = fopen(fn, "r");
-    if (fin == NULL) {
-        printf("Unable to open file \"%s\"\n", fn);
+    loaded_system = true;
+
+    // binary files are mapped and used in place
+    if (matrix_map(fn, nrhs, sizeof(REAL), &mapped_system)) {
+        n = mapped_system.n;
+        lda = n;
+        A = (REAL*)mapped_system.A;
+        b = (REAL*)mapped_system.b;
+        x = (REAL*)calloc(n*nrhs, sizeof(REAL));
+        if (x == NULL) {
+            printf("Unable to allocate memory for linear system\n");
+            exit(EXIT_FAILURE);
+        }
+        return;
+    }
+
+    // parse text file in parallel (the parser threads inherit the main
+    // thread's affinity, so unpin it meanwhile)
+    if (pin_mode) {
+        placement_unpin();
+    }
+    matrix_read_text(fn, nrhs, omp_get_max_threads(), &n, &A, &b, &lda);
+    if (pin_mode) {
+        placement_pin(0);
+    }
+    x = (REAL*)calloc(n*nrhs, sizeof(REAL));
+    if (x == NULL) {
+        printf("Unable to allocate memory for linear system\n");
         exit(EXIT_FAILURE);
     }
-    if (fscanf(fin, "%d\n", &n) != 1) {
-        printf("Invalid matrix file format\n");
+}
+
+/*
+ * Allocates the row permutation and initializes it to the identity.
+ */
+void init_permutation()
+{
+    perm = (int*)malloc(sizeof(int) * n);
+    if (perm == NULL) {
+        printf("Unable to allocate memory for linear system\n");
         exit(EXIT_FAILURE);
     }
+#   pragma omp parallel for default(none)\
+        shared(n, perm)
+    for (int row = 0; row < n; row++) {
+        perm[row] = row;
+    }
+}
 
-    // allocate space for matrices
-    A = (REAL*)malloc(sizeof(REAL) * n*n);
-    b = (REAL*)malloc(sizeof(REAL) * n);
-    x = (REAL*)malloc(sizeof(REAL) * n);
+/*
+ * Finds the row at or below the pivot with the largest magnitude in the
+ * pivot column (parallel max-abs reduction).
+ */
+pivot_t find_pivot(int pivot)
+{
+    pivot_t best = { -1.0, INT_MAX };
+#   pragma omp parallel for default(none)\
+        shared(A, lda, n, perm, pivot) reduction(maxabs:best)
+    for (int row = pivot; row < n; row++) {
+        REAL val = fabs(A[perm[row]*lda + pivot]);
+        if (val > best.val) {
+            best.val = val;
+            best.row = row;
+        }
+    }
+    return best;
+}
 
-    // verify that memory allocation succeeded
-    if (A == NULL || b == NULL || x == NULL) {
-        printf("Unable to allocate memory for linear system\n");
+/*
+ * Partial pivoting: moves the chosen row into the pivot position. Rows are
+ * swapped in the permutation only; A and b are never copied.
+ */
+void swap_pivot(int pivot, pivot_t best)
+{
+    if (best.val == 0.0) {
+        printf("Matrix is singular\n");
         exit(EXIT_FAILURE);
     }
+    int tmp = perm[pivot];
+    perm[pivot] = perm[best.row];
+    perm[best.row] = tmp;
+}
 
-    // read all values
-    for (int row = 0; row < n; row++) {
-        for (int col = 0; col < n; col++) {
-            if (fscanf(fin, "%lf", &A[row*n + col]) != 1) {
-                printf("Invalid matrix file format\n");
-                exit(EXIT_FAILURE);
+/*
+ * Generates the same system as rand_system() with the first pivot already
+ * eliminated: each row is updated against the pivot row right after it is
+ * generated, while it is still in cache, so the original A never has to be
+ * written out and read back. Elimination then starts at the second pivot.
+ */
+void rand_system_fused()
+{
+    alloc_system();
+
+    // with pivoting, pick the first pivot from column 0 (generated directly)
+    if (pivot_mode) {
+        pivot_t best = { -1.0, INT_MAX };
+#       pragma omp parallel for default(none)\
+            shared(n) reduction(maxabs:best)
+        for (int row = 0; row < n; row++) {
+            REAL val = fabs(rand_entry(row, 0));
+            if (val > best.val) {
+                best.val = val;
+                best.row = row;
             }
         }
-        if (fscanf(fin, "%lf", &b[row]) != 1) {
-            printf("Invalid matrix file format\n");
-            exit(EXIT_FAILURE);
+        swap_pivot(0, best);
+    }
+
+    int prow = perm[0];
+    rand_row(prow);
+#   pragma omp parallel for schedule(static) default(none)\
+        shared(A, lda, n, nrhs, b, prow)
+    for (int r = 0; r < n; r++) {
+        if (r == prow) {
+            continue;
         }
-        x[row] = 0.0;     // initialize x while we're reading A and b
+        rand_row(r);
+        REAL coeff = A[r*lda] / A[prow*lda];
+        A[r*lda] = coeff;
+        row_update(&A[r*lda + 1], &A[prow*lda + 1], coeff, n-1);
+        row_update(&b[r*nrhs], &b[prow*nrhs], coeff, nrhs);
     }
-    fclose(fin);
+    first_pivot = 1;
 }
 
 /*
- * Performs Gaussian elimination on the linear system.
- * Assumes the matrix is singular and doesn't require any pivoting.
+ * Performs Gaussian elimination on the linear system, leaving the multipliers
+ * below the diagonal so that A holds its L and U factors afterwards.
+ * Without pivot_mode, assumes the matrix doesn't require any pivoting.
+ * Starts at first_pivot (earlier pivots were eliminated during generation).
+ *
+ * With pivot_mode, the search for the next pivot is fused into the row
+ * updates: each thread tracks the largest entry of the next column in the
+ * rows it has just updated, so pivoting costs no extra pass over A.
  */
 void gaussian_elimination()
 {
+    pivot_t next = { -1.0, INT_MAX };
+    if (pivot_mode && first_pivot < n) {
+        next = find_pivot(first_pivot);
+    }
+
     // Better to be here
-    for (int pivot = 0; pivot < n; pivot++) {
+    for (int pivot = first_pivot; pivot < n; pivot++) {
+        if (pivot_mode) {
+            swap_pivot(pivot, next);
+        }
+        int prow = perm[pivot];
+        int blk = pivot / PROFILE_BLOCK;
+        pivot_t cand = { -1.0, INT_MAX };
+#       pragma omp parallel default(none)\
+            shared(A, lda, n, nrhs, b, perm, pivot, prow, blk, profile_enabled)\
+            reduction(maxabs:cand)
+        {
+            profile_begin("update", blk);
+#           pragma omp for schedule(static) nowait
+            for (int row = pivot+1; row < n; row++) {
+                int r = perm[row];
+                REAL coeff = A[r*lda + pivot] / A[prow*lda + pivot];
+                A[r*lda + pivot] = coeff;     // keep the multiplier (L below the diagonal)
+                row_update(&A[r*lda + pivot+1], &A[prow*lda + pivot+1], coeff, n-pivot-1);
+                row_update(&b[r*nrhs], &b[prow*nrhs], coeff, nrhs);
+
+                REAL val = fabs(A[r*lda + pivot+1]);
+                if (val > cand.val) {
+                    cand.val = val;
+                    cand.row = row;
+                }
+            }
+            profile_end();
+
+            // when profiling, time each thread's wait for the slowest one
+            if (profile_enabled) {
+                PROFILE_SCOPE_BLOCK("barrier", blk);
+#               pragma omp barrier
+            }
+        }
+        next = cand;
+    }
+}
+
+/*
+ * Applies the pivots in columns k0..k1-1 to a tile of the trailing matrix
+ * (rows r0..r1-1, columns c0..c1-1). Expects the multipliers for the tile's
+ * rows to be stored in the panel columns and the pivot rows to be final.
+ *
+ * The main loop keeps a 4x4 block of the tile in registers for the whole
+ * panel; the updates are still applied one pivot at a time.
+ */
+void update_tile(int r0, int r1, int c0, int c1, int k0, int k1)
+{
+    int row = r0;
+    for (; row + 4 <= r1; row += 4) {
+        REAL *a[4];
+        for (int i = 0; i < 4; i++) {
+            a[i] = &A[perm[row+i]*lda];
+        }
+        int col = c0;
+        for (; col + 4 <= c1; col += 4) {
+            REAL acc[4][4];
+            for (int i = 0; i < 4; i++) {
+                for (int j = 0; j < 4; j++) {
+                    acc[i][j] = a[i][col+j];
+                }
+            }
+            for (int pivot = k0; pivot < k1; pivot++) {
+                REAL *p = &A[perm[pivot]*lda];
+                for (int i = 0; i < 4; i++) {
+                    REAL coeff = a[i][pivot];
+                    for (int j = 0; j < 4; j++) {
+                        acc[i][j] -= p[col+j] * coeff;
+                    }
+                }
+            }
+            for (int i = 0; i < 4; i++) {
+                for (int j = 0; j < 4; j++) {
+                    a[i][col+j] = acc[i][j];
+                }
+            }
+        }
+        for (int i = 0; i < 4; i++) {
+            for (int pivot = k0; pivot < k1; pivot++) {
+                REAL *p = &A[perm[pivot]*lda];
+                REAL coeff = a[i][pivot];
+                for (int j = col; j < c1; j++) {
+                    a[i][j] -= p[j] * coeff;
+                }
+            }
+        }
+    }
+    for (; row < r1; row++) {
+        int r = perm[row];
+        for (int pivot = k0; pivot < k1; pivot++) {
+            int prow = perm[pivot];
+            REAL coeff = A[r*lda + pivot];
+            for (int col = c0; col < c1; col++) {
+                A[r*lda + col] -= A[prow*lda + col] * coeff;
+            }
+        }
+    }
+}
+
+/*
+ * Performs Gaussian elimination on the linear system using a cache-blocked
+ * right-looking algorithm: each panel of block_size columns is factored and
+ * then applied to the trailing matrix one cache-sized tile at a time, so A is
+ * streamed through memory once per panel instead of once per pivot.
+ *
+ * Every entry receives the same updates in the same order as in
+ * gaussian_elimination(), so both produce identical results (including the
+ * multipliers left below the diagonal).
+ */
+void gaussian_elimination_blocked()
+{
+    // panels end on multiples of block_size (the first one is shorter when
+    // the first pivot was eliminated during generation)
+    for (int k0 = first_pivot; k0 < n; ) {
+        int k1 = (k0 / block_size + 1) * block_size;
+        k1 = (k1 < n) ? k1 : n;
+        int blk = k0 / block_size;
+
+        profile_begin("panel", blk);
+        if (pivot_mode) {
+            // the pivot search needs the whole column, so factor the panel
+            // one pivot at a time (multipliers are kept in place)
+            pivot_t next = find_pivot(k0);
+            for (int pivot = k0; pivot < k1; pivot++) {
+                swap_pivot(pivot, next);
+                int prow = perm[pivot];
+                pivot_t cand = { -1.0, INT_MAX };
+#               pragma omp parallel for default(none)\
+                    shared(A, lda, n, nrhs, b, perm, pivot, prow, k1) reduction(maxabs:cand)
+                for (int row = pivot+1; row < n; row++) {
+                    int r = perm[row];
+                    REAL coeff = A[r*lda + pivot] / A[prow*lda + pivot];
+                    A[r*lda + pivot] = coeff;
+                    row_update(&A[r*lda + pivot+1], &A[prow*lda + pivot+1], coeff, k1-pivot-1);
+                    row_update(&b[r*nrhs], &b[prow*nrhs], coeff, nrhs);
+
+                    if (pivot+1 < k1) {
+                        REAL val = fabs(A[r*lda + pivot+1]);
+                        if (val > cand.val) {
+                            cand.val = val;
+                            cand.row = row;
+                        }
+                    }
+                }
+                next = cand;
+            }
+        } else {
+            // factor the diagonal block (small, so done by a single thread)
+            for (int pivot = k0; pivot < k1; pivot++) {
+                for (int row = pivot+1; row < k1; row++) {
+                    REAL coeff = A[row*lda + pivot] / A[pivot*lda + pivot];
+                    A[row*lda + pivot] = coeff;
+                    row_update(&A[row*lda + pivot+1], &A[pivot*lda + pivot+1], coeff, k1-pivot-1);
+                    row_update(&b[row*nrhs], &b[pivot*nrhs], coeff, nrhs);
+                }
+            }
+
+            // factor the rest of the panel (multipliers are kept in place)
+#           pragma omp parallel for default(none)\
+                shared(A, lda, n, nrhs, b, k0, k1)
+            for (int row = k1; row < n; row++) {
+                for (int pivot = k0; pivot < k1; pivot++) {
+                    REAL coeff = A[row*lda + pivot] / A[pivot*lda + pivot];
+                    A[row*lda + pivot] = coeff;
+                    row_update(&A[row*lda + pivot+1], &A[pivot*lda + pivot+1], coeff, k1-pivot-1);
+                    row_update(&b[row*nrhs], &b[pivot*nrhs], coeff, nrhs);
+                }
+            }
+        }
+
+        profile_end();
+
+        // update the block row to the right of the diagonal block
+        profile_begin("block_row", blk);
 #       pragma omp parallel for default(none)\
-            shared(A, n, b, pivot)
-        for (int row = pivot+1; row < n; row++) {
-            REAL coeff = A[row*n + pivot] / A[pivot*n + pivot];
-            A[row*n + pivot] = 0.0;
-            for (int col = pivot+1; col < n; col++) {
-                A[row*n + col] -= A[pivot*n + col] * coeff;
+            shared(A, lda, n, perm, k0, k1)
+        for (int c0 = k1; c0 < n; c0 += TILE_COLS) {
+            int c1 = (c0 + TILE_COLS < n) ? c0 + TILE_COLS : n;
+            for (int pivot = k0; pivot < k1; pivot++) {
+                int prow = perm[pivot];
+                for (int row = pivot+1; row < k1; row++) {
+                    int r = perm[row];
+                    REAL coeff = A[r*lda + pivot];
+                    row_update(&A[r*lda + c0], &A[prow*lda + c0], coeff, c1-c0);
+                }
             }
-            b[row] -= b[pivot] * coeff;
         }
+
+        profile_end();
+
+        // update the trailing matrix
+        profile_begin("trailing", blk);
+#       pragma omp parallel for collapse(2) schedule(dynamic) default(none)\
+            shared(n, k0, k1)
+        for (int r0 = k1; r0 < n; r0 += TILE_ROWS) {
+            for (int c0 = k1; c0 < n; c0 += TILE_COLS) {
+                int r1 = (r0 + TILE_ROWS < n) ? r0 + TILE_ROWS : n;
+                int c1 = (c0 + TILE_COLS < n) ? c0 + TILE_COLS : n;
+                update_tile(r0, r1, c0, c1, k0, k1);
+            }
+        }
+        profile_end();
+
+        k0 = k1;
     }
 }
 
 /*
- * Performs backwards substitution on the linear system.
- * (row-oriented version)
+ * Factors the diagonal tile of pivots [k0, k1) in place (no pivoting).
  */
-void back_substitution_row()
+void factor_diagonal_tile(int k0, int k1)
 {
-    REAL tmp = 0;
-    for (int row = n-1; row >= 0; row--) {
-        tmp = b[row];
-#        pragma omp parallel for default(none) \
-            shared(A, x, n, row) reduction(-:tmp)
-        for (int col = row+1; col < n; col++) {
-            tmp += -A[row*n + col] * x[col];
+    PROFILE_SCOPE_BLOCK("panel", k0 / PROFILE_BLOCK);
+    for (int pivot = k0; pivot < k1; pivot++) {
+        for (int row = pivot+1; row < k1; row++) {
+            REAL coeff = A[row*lda + pivot] / A[pivot*lda + pivot];
+            A[row*lda + pivot] = coeff;
+            row_update(&A[row*lda + pivot+1], &A[pivot*lda + pivot+1], coeff, k1-pivot-1);
+        }
+    }
+}
+
+/*
+ * Computes the multipliers for rows [r0, r1) below the diagonal tile of
+ * pivots [k0, k1), keeping them in place.
+ */
+void factor_column_tile(int r0, int r1, int k0, int k1)
+{
+    PROFILE_SCOPE_BLOCK("panel", k0 / PROFILE_BLOCK);
+    for (int row = r0; row < r1; row++) {
+        for (int pivot = k0; pivot < k1; pivot++) {
+            REAL coeff = A[row*lda + pivot] / A[pivot*lda + pivot];
+            A[row*lda + pivot] = coeff;
+            row_update(&A[row*lda + pivot+1], &A[pivot*lda + pivot+1], coeff, k1-pivot-1);
+        }
+    }
+}
+
+/*
+ * Applies pivots [k0, k1) to columns [c0, c1) of their own rows (the block
+ * row to the right of the diagonal tile).
+ */
+void update_row_tile(int c0, int c1, int k0, int k1)
+{
+    PROFILE_SCOPE_BLOCK("block_row", k0 / PROFILE_BLOCK);
+    for (int pivot = k0; pivot < k1; pivot++) {
+        for (int row = pivot+1; row < k1; row++) {
+            row_update(&A[row*lda + c0], &A[pivot*lda + c0], A[row*lda + pivot], c1-c0);
+        }
+    }
+}
+
+/*
+ * Applies pivots [k0, k1) to rows [r0, r1) of b (each row only takes the
+ * pivots above it).
+ */
+void update_rhs_tile(int r0, int r1, int k0, int k1)
+{
+    for (int row = r0; row < r1; row++) {
+        for (int pivot = k0; pivot < k1 && pivot < row; pivot++) {
+            row_update(&b[row*nrhs], &b[pivot*nrhs], A[row*lda + pivot], nrhs);
+        }
+    }
+}
+
+/*
+ * Performs Gaussian elimination as a tiled LU factorization whose tile
+ * operations are OpenMP tasks, ordered only by their data dependences:
+ * factoring the diagonal tile, computing the multipliers of the tiles below
+ * it, updating the tiles to its right (and b), and the trailing tile updates.
+ * There is no barrier between pivots or panels, so the next panel is factored
+ * as soon as its own column has been updated (look-ahead) while the rest of
+ * the trailing matrix is still being updated. Tasks on the critical path get
+ * a higher priority (used if OMP_MAX_TASK_PRIORITY is set). Without pivoting,
+ * each element sees the same operations in the same order as in
+ * gaussian_elimination(), so the results are identical.
+ */
+void gaussian_elimination_tasks()
+{
+    int nb = (block_size > 0) ? block_size : TASK_BLOCK;
+    int nt = (n - first_pivot + nb - 1) / nb;
+
+    // one dependence token per tile (I, J) of A, plus column nt for tile I of
+    // b; only their addresses matter
+    char *dep = (char*)malloc((size_t)nt * (nt+1) + 1);
+    if (dep == NULL) {
+        printf("Unable to allocate memory for task dependences\n");
+        exit(EXIT_FAILURE);
+    }
+
+#   pragma omp parallel default(none) shared(n, nb, nt, dep, first_pivot)
+#   pragma omp single
+    for (int k = 0; k < nt; k++) {
+        int k0 = first_pivot + k*nb;
+        int k1 = (k0 + nb < n) ? k0 + nb : n;
+
+#       pragma omp task depend(inout: dep[k*(nt+1) + k]) priority(1)
+        factor_diagonal_tile(k0, k1);
+
+#       pragma omp task depend(in: dep[k*(nt+1) + k]) depend(inout: dep[k*(nt+1) + nt])
+        update_rhs_tile(k0, k1, k0, k1);
+
+        for (int j = k+1; j < nt; j++) {
+            int c0 = first_pivot + j*nb;
+            int c1 = (c0 + nb < n) ? c0 + nb : n;
+#           pragma omp task depend(in: dep[k*(nt+1) + k]) depend(inout: dep[k*(nt+1) + j])\
+                priority(j == k+1)
+            update_row_tile(c0, c1, k0, k1);
+        }
+
+        for (int i = k+1; i < nt; i++) {
+            int r0 = first_pivot + i*nb;
+            int r1 = (r0 + nb < n) ? r0 + nb : n;
+#           pragma omp task depend(in: dep[k*(nt+1) + k]) depend(inout: dep[i*(nt+1) + k])\
+                priority(1)
+            factor_column_tile(r0, r1, k0, k1);
+
+            for (int j = k+1; j < nt; j++) {
+                int c0 = first_pivot + j*nb;
+                int c1 = (c0 + nb < n) ? c0 + nb : n;
+#               pragma omp task depend(in: dep[i*(nt+1) + k], dep[k*(nt+1) + j])\
+                    depend(inout: dep[i*(nt+1) + j]) priority(j == k+1)
+                {
+                    PROFILE_SCOPE_BLOCK("trailing", k0 / PROFILE_BLOCK);
+                    update_tile(r0, r1, c0, c1, k0, k1);
+                }
+            }
+
+#           pragma omp task depend(in: dep[i*(nt+1) + k], dep[k*(nt+1) + nt])\
+                depend(inout: dep[i*(nt+1) + nt])
+            update_rhs_tile(r0, r1, k0, k1);
         }
-        x[row] = tmp / A[row*n + row];
     }
+
+    free(dep);
 }
 
 /*
@@ -188,20 +720,217 @@ void back_substitution_row()
 void back_substitution_column()
 {
 #   pragma omp parallel for default(none)\
-        shared(n, b, x)
+        shared(n, b, x, perm)
     for (int row = 0; row < n; row++) {
-        x[row] = b[row];
+        x[row] = b[perm[row]];
     }
     for (int col = n-1; col >= 0; col--) {
-        x[col] /= A[col*n + col];
+        x[col] /= A[perm[col]*lda + col];
         #pragma omp parallel for default(none)\
-            shared(A, x, n, col)
+            shared(A, lda, x, n, perm, col)
         for (int row = 0; row < col; row++) {
-            x[row] += -A[row*n + col] * x[col];
+            x[row] += -A[perm[row]*lda + col] * x[col];
+        }
+    }
+}
+
+/*
+ * Solves the diagonal block of rows [i0, i1) for x, once the rows below it
+ * have been applied.
+ */
+void solve_diagonal_block(int i0, int i1)
+{
+    for (int row = i1-1; row >= i0; row--) {
+        int r = perm[row];
+        if (nrhs == 1) {
+            x[row] = (x[row] - dot(&A[r*lda + row+1], &x[row+1], i1 - row - 1)) / A[r*lda + row];
+        } else {
+            for (int col = row+1; col < i1; col++) {
+                row_update(&x[row*nrhs], &x[col*nrhs], A[r*lda + col], nrhs);
+            }
+            for (int j = 0; j < nrhs; j++) {
+                x[row*nrhs + j] /= A[r*lda + row];
+            }
+        }
+    }
+}
+
+/*
+ * Applies the solved rows [i0, i1) to a row above them (one row of the
+ * matrix-vector product with the block of A in columns [i0, i1)).
+ */
+void apply_block_to_row(int row, int i0, int i1)
+{
+    int r = perm[row];
+    if (nrhs == 1) {
+        x[row] -= dot(&A[r*lda + i0], &x[i0], i1 - i0);
+    } else {
+        for (int col = i0; col < i1; col++) {
+            row_update(&x[row*nrhs], &x[col*nrhs], A[r*lda + col], nrhs);
+        }
+    }
+}
+
+/*
+ * Performs backwards substitution for all nrhs right-hand sides as a blocked
+ * triangular solve in a single parallel region. For each block of BSUB_BLOCK
+ * rows (bottom to top), one thread solves the small diagonal block, then all
+ * threads apply it to their share of the rows above it. That is two barriers
+ * per block instead of a parallel region per row.
+ */
+void back_substitution_blocked()
+{
+#   pragma omp parallel default(none) shared(A, lda, b, x, n, nrhs, perm)
+    {
+#       pragma omp for schedule(static)
+        for (int row = 0; row < n; row++) {
+            for (int j = 0; j < nrhs; j++) {
+                x[row*nrhs + j] = b[perm[row]*nrhs + j];
+            }
+        }
+
+        for (int i1 = n; i1 > 0; i1 -= BSUB_BLOCK) {
+            int i0 = (i1 - BSUB_BLOCK > 0) ? i1 - BSUB_BLOCK : 0;
+
+#           pragma omp single
+            solve_diagonal_block(i0, i1);
+
+#           pragma omp for schedule(static)
+            for (int row = 0; row < i0; row++) {
+                apply_block_to_row(row, i0, i1);
+            }
+        }
+    }
+}
+
+/*
+ * Mixed precision: copies A into Af (single precision) and factors it there
+ * in parallel, leaving the float multipliers below the diagonal. A itself is
+ * kept in double precision for the residuals in solve_mixed(). b is not
+ * touched.
+ */
+void factor_mixed()
+{
+    ldf = matrix_lda(n, sizeof(float));
+    Af = (float*)matrix_alloc((size_t)n*ldf*sizeof(float));
+    if (Af == NULL) {
+        printf("Unable to allocate memory for linear system\n");
+        exit(EXIT_FAILURE);
+    }
+#   pragma omp parallel for schedule(static) default(none) shared(A, lda, Af, ldf, n)
+    for (int row = 0; row < n; row++) {
+        for (int col = 0; col < n; col++) {
+            Af[row*ldf + col] = (float)A[row*lda + col];
+        }
+    }
+
+    for (int pivot = 0; pivot < n; pivot++) {
+        if (pivot_mode) {
+            pivot_t best = { -1.0, INT_MAX };
+#           pragma omp parallel for default(none)\
+                shared(Af, ldf, n, perm, pivot) reduction(maxabs:best)
+            for (int row = pivot; row < n; row++) {
+                REAL val = fabsf(Af[perm[row]*ldf + pivot]);
+                if (val > best.val) {
+                    best.val = val;
+                    best.row = row;
+                }
+            }
+            swap_pivot(pivot, best);
+        }
+        int prow = perm[pivot];
+#       pragma omp parallel for schedule(static) default(none)\
+            shared(Af, ldf, n, perm, pivot, prow)
+        for (int row = pivot+1; row < n; row++) {
+            int r = perm[row];
+            float coeff = Af[r*ldf + pivot] / Af[prow*ldf + pivot];
+            Af[r*ldf + pivot] = coeff;
+            row_update(&Af[r*ldf + pivot+1], &Af[prow*ldf + pivot+1], coeff, n-pivot-1);
         }
     }
 }
 
+/*
+ * Solves LU d = r with the single precision factors in Af (forward
+ * substitution with L on the permuted r, then back substitution with U).
+ * r is indexed by physical row like b; d (and w, n floats of scratch) by
+ * logical row like x.
+ */
+void lu_solve_float(const REAL *r, REAL *d, float *w)
+{
+    for (int row = 0; row < n; row++) {
+        int pr = perm[row];
+        w[row] = (float)r[pr] - dot(&Af[pr*ldf], w, row);
+    }
+    for (int row = n-1; row >= 0; row--) {
+        int pr = perm[row];
+        w[row] = (w[row] - dot(&Af[pr*ldf + row+1], &w[row+1], n-row-1)) / Af[pr*ldf + row];
+    }
+    for (int row = 0; row < n; row++) {
+        d[row] = w[row];
+    }
+}
+
+/*
+ * Mixed precision: solves for each right-hand side with the float factors,
+ * then refines the solution: computes the residual r = b - Ax in double
+ * precision against the original A (in parallel), solves LU d = r in single
+ * precision and adds the correction, until the correction no longer changes
+ * x (or stops shrinking, or after REFINE_MAX_ITERS steps).
+ */
+void solve_mixed()
+{
+    REAL *xc = (REAL*)malloc(n * sizeof(REAL));
+    REAL *r = (REAL*)malloc(n * sizeof(REAL));
+    REAL *d = (REAL*)malloc(n * sizeof(REAL));
+    float *w = (float*)malloc(n * sizeof(float));
+    if (xc == NULL || r == NULL || d == NULL || w == NULL) {
+        printf("Unable to allocate memory for linear system\n");
+        exit(EXIT_FAILURE);
+    }
+
+    refine_iters = 0;
+    for (int j = 0; j < nrhs; j++) {
+        for (int row = 0; row < n; row++) {
+            r[row] = b[row*nrhs + j];
+        }
+        lu_solve_float(r, xc, w);
+
+        REAL prev = INFINITY;
+        for (int iter = 0; iter < REFINE_MAX_ITERS; iter++) {
+            PROFILE_SCOPE("refine");
+#           pragma omp parallel for schedule(static) default(none)\
+                shared(A, lda, b, n, nrhs, j, r, xc)
+            for (int row = 0; row < n; row++) {
+                r[row] = b[row*nrhs + j] - dot(&A[row*lda], xc, n);
+            }
+            lu_solve_float(r, d, w);
+            REAL dnorm = 0.0, xnorm = 0.0;
+            for (int row = 0; row < n; row++) {
+                xc[row] += d[row];
+                dnorm = fmax(dnorm, fabs(d[row]));
+                xnorm = fmax(xnorm, fabs(xc[row]));
+            }
+            if (iter + 1 > refine_iters) {
+                refine_iters = iter + 1;
+            }
+            if (dnorm <= DBL_EPSILON * xnorm || dnorm >= prev) {
+                break;
+            }
+            prev = dnorm;
+        }
+
+        for (int row = 0; row < n; row++) {
+            x[row*nrhs + j] = xc[row];
+        }
+    }
+
+    free(xc);
+    free(r);
+    free(d);
+    free(w);
+}
+
 /*
  * Find the maximum error in the solution (only works for randomly-generated
  * matrices).
@@ -210,9 +939,11 @@ REAL find_max_error()
 {
     REAL error = 0.0, tmp;
     for (int row = 0; row < n; row++) {
-        tmp = fabs(x[row] - 1.0);
-        if (tmp > error) {
-            error = tmp;
+        for (int j = 0; j < nrhs; j++) {
+            tmp = fabs(x[row*nrhs + j] - (j+1));
+            if (tmp > error) {
+                error = tmp;
+            }
         }
     }
     return error;
@@ -231,69 +962,159 @@ void print_matrix(REAL *mat, int rows, int cols)
     }
 }
 
-int main(int argc, char *argv[])
+/*
+ * Prints a matrix stored with the row permutation in logical row order.
+ */
+void print_permuted_matrix(REAL *mat, int rows, int cols, int ld)
 {
+    for (int row = 0; row < rows; row++) {
+        for (int col = 0; col < cols; col++) {
+            printf("%8.1e ", mat[perm[row]*ld + col]);
+        }
+        printf("\n");
+    }
+}
+
+/*
+ * Runs the program with the given command line. If result is not NULL (when
+ * called by the benchmark driver), the error and phase times are stored there
+ * instead of being printed.
+ */
+int run(int argc, char *argv[], bench_result_t *result)
+{
+    // reset the options, since the benchmark driver calls run() repeatedly
+    optind = 1;
+    nrhs = 1;
+    block_size = 0;
+    debug_mode = triangular_mode = pivot_mode = fused_mode = mixed_mode = false;
+    pin_mode = interleave_mode = task_mode = false;
+    first_pivot = 0;
+
     // check and parse command line options
     int c;
-    while ((c = getopt(argc, argv, "dt")) != -1) {
+    while ((c = getopt(argc, argv, "ab:dfgik:mpt")) != -1) {
         switch (c) {
+        case 'a':
+            pin_mode = true;
+            break;
+        case 'b':
+            block_size = (int)strtol(optarg, NULL, 10);
+            if (block_size <= 0) {
+                printf("Invalid panel width: %s\n", optarg);
+                exit(EXIT_FAILURE);
+            }
+            break;
         case 'd':
             debug_mode = true;
             break;
+        case 'f':
+            fused_mode = true;
+            break;
+        case 'g':
+            task_mode = true;
+            break;
+        case 'i':
+            interleave_mode = true;
+            break;
+        case 'k':
+            nrhs = (int)strtol(optarg, NULL, 10);
+            if (nrhs <= 0) {
+                printf("Invalid number of right-hand sides: %s\n", optarg);
+                exit(EXIT_FAILURE);
+            }
+            break;
+        case 'm':
+            mixed_mode = true;
+            break;
+        case 'p':
+            pivot_mode = true;
+            break;
         case 't':
             triangular_mode = true;
             break;
         default:
-            printf("Usage: %s [-dt] <file|size>\n", argv[0]);
+            printf("Usage: %s [-adfgimpt] [-b <panel>] [-k <nrhs>] <file|size>\n", argv[0]);
             exit(EXIT_FAILURE);
         }
     }
     if (optind != argc-1) {
-        printf("Usage: %s [-dt] <file|size>\n", argv[0]);
+        printf("Usage: %s [-adfgimpt] [-b <panel>] [-k <nrhs>] <file|size>\n", argv[0]);
+        exit(EXIT_FAILURE);
+    }
+    if (mixed_mode && (block_size > 0 || fused_mode || triangular_mode || task_mode)) {
+        printf("Mixed precision (-m) can't be combined with -b, -f, -g or -t\n");
+        exit(EXIT_FAILURE);
+    }
+    if (task_mode && pivot_mode) {
+        printf("Task-based elimination (-g) can't be combined with -p\n");
         exit(EXIT_FAILURE);
     }
 
+    if (pin_mode) {
+        pin_threads();
+    }
+
     // read or generate linear system
     long int size = strtol(argv[optind], NULL, 10);
     START_TIMER(init)
     if (size == 0) {
         read_system(argv[optind]);
+        init_permutation();
     } else {
         n = (int)size;
-        rand_system();
+        init_permutation();
+        if (fused_mode && !triangular_mode) {
+            rand_system_fused();
+        } else {
+            rand_system();
+        }
     }
     STOP_TIMER(init)
 
     if (debug_mode) {
-        printf("Original A = \n");
-        print_matrix(A, n, n);
-        printf("Original b = \n");
-        print_matrix(b, n, 1);
+        printf(first_pivot ? "A after the first pivot = \n" : "Original A = \n");
+        print_permuted_matrix(A, n, n, lda);
+        printf(first_pivot ? "b after the first pivot = \n" : "Original b = \n");
+        print_permuted_matrix(b, n, nrhs, nrhs);
     }
 
     // perform gaussian elimination
     START_TIMER(gaus)
-    if (!triangular_mode) {
-        gaussian_elimination();
+    if (mixed_mode) {
+        factor_mixed();
+    } else if (!triangular_mode) {
+        if (task_mode) {
+            gaussian_elimination_tasks();
+        } else if (block_size > 0) {
+            gaussian_elimination_blocked();
+        } else {
+            gaussian_elimination();
+        }
     }
     STOP_TIMER(gaus)
 
     // perform backwards substitution
     START_TIMER(bsub)
-#   ifndef USE_COLUMN_BACKSUB
-    back_substitution_row();
-#   else
-    back_substitution_column();
+    if (mixed_mode) {
+        solve_mixed();
+#   ifdef USE_COLUMN_BACKSUB
+    } else if (nrhs == 1) {
+        back_substitution_column();
 #   endif
+    } else {
+        back_substitution_blocked();
+    }
     STOP_TIMER(bsub)
 
-    if (debug_mode) {
-        printf("Triangular A = \n");
-        print_matrix(A, n, n);
+    if (debug_mode && !mixed_mode) {
+        printf("Factored A (L below the diagonal, U on and above) = \n");
+        print_permuted_matrix(A, n, n, lda);
         printf("Updated b = \n");
-        print_matrix(b, n, 1);
+        print_permuted_matrix(b, n, nrhs, nrhs);
+    }
+    if (debug_mode) {
         printf("Solution x = \n");
-        print_matrix(x, n, 1);
+        print_matrix(x, n, nrhs);
     }
 
     int threads = 1;
@@ -303,14 +1124,58 @@ int main(int argc, char *argv[])
     threads = omp_get_max_threads();
     #endif
 
-    // print results
-    printf("Nthreads=%2d  ERR=%8.1e  INIT: %8.4fs  GAUS: %8.4fs  BSUB: %8.4fs\n",
-            threads, find_max_error(),
-            GET_TIMER(init), GET_TIMER(gaus), GET_TIMER(bsub));
+    // print results (or return them to the benchmark driver)
+    if (result != NULL) {
+        result->threads = threads;
+        result->err = find_max_error();
+        result->init = GET_TIMER(init);
+        result->gaus = GET_TIMER(gaus);
+        result->bsub = GET_TIMER(bsub);
+    } else {
+        printf("Nthreads=%2d  ERR=%8.1e  INIT: %8.4fs  GAUS: %8.4fs  BSUB: %8.4fs\n",
+                threads, find_max_error(),
+                GET_TIMER(init), GET_TIMER(gaus), GET_TIMER(bsub));
+
+        // report thread and memory placement (if either was requested)
+        if (pin_mode || interleave_mode) {
+            placement_report(threads, interleave_mode, loaded_system);
+        }
+
+        if (mixed_mode) {
+            printf("MIXED: factored in single precision, %d refinement steps\n", refine_iters);
+        }
+
+        // print per-phase hardware counters (if enabled with TIMER_COUNTERS)
+        perf_report(GET_COUNTERS(init), GET_TIMER(init), GET_COUNTERS(gaus), GET_TIMER(gaus),
+                GET_COUNTERS(bsub), GET_TIMER(bsub));
+    }
+
+    // write the profile (if enabled with TIMER_PROFILE)
+    profile_write();
 
     // clean up and exit
-    free(A);
-    free(b);
+    if (mapped_system.base != NULL) {
+        matrix_unmap(&mapped_system);
+    } else {
+        matrix_free(A);
+        free(b);
+    }
+    if (mixed_mode) {
+        matrix_free(Af);
+    }
     free(x);
+    free(perm);
     return EXIT_SUCCESS;
-}
\ No newline at end of file
+}
+
+#ifdef LIBRARY_BUILD
+BENCH_EXPORT int bench_run(int argc, char *argv[], bench_result_t *result)
+{
+    return run(argc, argv, result);
+}
+#else
+int main(int argc, char *argv[])
+{
+    return run(argc, argv, NULL);
+}
+#endif
@@ -0,0 +1,231 @@
+/**
+ * placement.h
+ *
+ * NUMA-aware memory and thread placement for the parallel backends.
+ *
+ * Linux places a page on the NUMA node of the thread that first writes it.
+ * If the main thread allocates and clears A, every page lands on one socket
+ * and threads on the other socket pay remote latency on every pivot. So:
+ *
+ *  - placement_alloc() returns memory from matrix_alloc(), whose pages have
+ *    not been touched yet; the backends then clear it in parallel, each thread
+ *    touching the rows it updates in elimination (first touch).
+ *  - With interleave set, the pages are instead spread round-robin over all
+ *    nodes (mbind(MPOL_INTERLEAVE)), which helps when the row distribution
+ *    shifts too much for first touch to pay off.
+ *  - placement_pin() pins the calling thread to one CPU, so threads stay on
+ *    the node holding their rows. Thread t gets the t-th CPU the process is
+ *    allowed to run on (so taskset and the benchmark driver's -P still
+ *    apply).
+ *
+ * Only Linux system calls are used (no libnuma). On machines with a single
+ * node, interleaving is a no-op.
+ *
+ * Example:
+ *
+ *      placement_init();                               // in the main thread
+ *      placement_pin(tid);                             // in every thread
+ *      placement_unpin();                              // e.g. to spawn helpers
+ *      A = (REAL*)placement_alloc((size_t)n*lda*sizeof(REAL), interleave);
+ *      ...                                             // parallel first touch
+ *      placement_report(threads, interleave, false);
+ *      matrix_free(A);
+ */
+
+#ifndef PLACEMENT_H
+#define PLACEMENT_H
+
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "matrix_alloc.h"
+
+#define PLACEMENT_MAX_THREADS   1024
+#define PLACEMENT_MAX_NODES     64
+
+// memory policy for mbind() (from <linux/mempolicy.h>)
+#define PLACEMENT_MPOL_INTERLEAVE   3
+
+// CPUs the process may run on, read before any thread is pinned
+static cpu_set_t placement_allowed;
+static int placement_nallowed = -1;
+
+// CPU each thread was pinned to (valid once placement_pinned is set)
+static int placement_cpus[PLACEMENT_MAX_THREADS];
+static bool placement_pinned = false;
+
+/*
+ * Reads a list of ranges like "0-3,8,10-11" from a sysfs file into a bit
+ * mask. Returns the number of bits set (0 if the file doesn't exist).
+ */
+static int placement_read_list(const char *path, unsigned long *mask)
+{
+    *mask = 0;
+    FILE *fin = fopen(path, "r");
+    if (fin == NULL) {
+        return 0;
+    }
+    char buf[256];
+    int count = 0;
+    if (fgets(buf, sizeof(buf), fin) != NULL) {
+        for (char *tok = strtok(buf, ",\n"); tok != NULL; tok = strtok(NULL, ",\n")) {
+            int lo, hi;
+            if (sscanf(tok, "%d-%d", &lo, &hi) != 2) {
+                hi = lo = atoi(tok);
+            }
+            for (int i = lo; i <= hi && i < PLACEMENT_MAX_NODES; i++) {
+                *mask |= 1UL << i;
+                count++;
+            }
+        }
+    }
+    fclose(fin);
+    return count;
+}
+
+/*
+ * Returns the number of online NUMA nodes (1 if unknown) and their mask.
+ */
+static int placement_nodes(unsigned long *mask)
+{
+    int count = placement_read_list("/sys/devices/system/node/online", mask);
+    if (count == 0) {
+        *mask = 1;
+        count = 1;
+    }
+    return count;
+}
+
+/*
+ * Returns the NUMA node of a CPU (0 if unknown).
+ */
+static int placement_node_of(int cpu)
+{
+    unsigned long mask;
+    placement_nodes(&mask);
+    for (int node = 0; node < PLACEMENT_MAX_NODES; node++) {
+        if (mask & (1UL << node)) {
+            char path[128];
+            snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpu%d", node, cpu);
+            if (access(path, F_OK) == 0) {
+                return node;
+            }
+        }
+    }
+    return 0;
+}
+
+/*
+ * Allocates memory with matrix_alloc() (zero-filled and not yet touched).
+ * With interleave, the pages are spread over all NUMA nodes; otherwise each
+ * page is placed when it is first written. Release with matrix_free().
+ * Returns NULL on failure.
+ */
+static void *placement_alloc(size_t bytes, bool interleave)
+{
+    void *ptr = matrix_alloc(bytes);
+    if (ptr == NULL) {
+        return NULL;
+    }
+
+    unsigned long mask;
+    if (interleave && placement_nodes(&mask) > 1) {
+        size_t page = (size_t)sysconf(_SC_PAGESIZE);
+        uintptr_t start = (uintptr_t)ptr / page * page;
+        size_t size = ((uintptr_t)ptr + bytes - start + page - 1) / page * page;
+        if (syscall(SYS_mbind, (void *)start, size, PLACEMENT_MPOL_INTERLEAVE, &mask,
+                    PLACEMENT_MAX_NODES + 1, 0) != 0) {
+            perror("mbind");
+        }
+    }
+    return ptr;
+}
+
+/*
+ * Records the CPUs the process may run on. Call from the main thread before
+ * placement_pin(); the mask is only read the first time, since the main
+ * thread is itself pinned afterwards.
+ */
+static void placement_init()
+{
+    if (placement_nallowed < 0) {
+        sched_getaffinity(0, sizeof(placement_allowed), &placement_allowed);
+        placement_nallowed = CPU_COUNT(&placement_allowed);
+    }
+    placement_pinned = false;
+}
+
+/*
+ * Pins the calling thread to the tid-th CPU of the process's affinity mask
+ * (wrapping around if there are more threads than CPUs).
+ */
+static void placement_pin(int tid)
+{
+    if (tid >= PLACEMENT_MAX_THREADS || placement_nallowed <= 0) {
+        return;
+    }
+
+    int cpu = -1;
+    for (int i = 0, seen = 0; i < CPU_SETSIZE; i++) {
+        if (CPU_ISSET(i, &placement_allowed) && seen++ == tid % placement_nallowed) {
+            cpu = i;
+            break;
+        }
+    }
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    if (sched_setaffinity(0, sizeof(set), &set) != 0) {
+        perror("sched_setaffinity");
+        return;
+    }
+    placement_cpus[tid] = cpu;
+    placement_pinned = true;
+}
+
+/*
+ * Lets the calling thread run on every CPU the process may use again, e.g.
+ * while it creates helper threads (which inherit its affinity mask).
+ * placement_pin() pins it again.
+ */
+static void placement_unpin()
+{
+    if (placement_nallowed <= 0) {
+        return;
+    }
+    if (sched_setaffinity(0, sizeof(placement_allowed), &placement_allowed) != 0) {
+        perror("sched_setaffinity");
+    }
+}
+
+/*
+ * Prints the memory policy and, if threads were pinned, the CPU and node of
+ * each thread, e.g.
+ *
+ *      PLACEMENT: nodes=2 memory=first-touch threads=0@0,1@0,2@1,3@1
+ *
+ * The policy is "loader" for a system read from a file, which was not
+ * allocated with placement_alloc() and so keeps the placement of the loader
+ * (the page cache for a mapped file).
+ */
+static void placement_report(int threads, bool interleave, bool loaded)
+{
+    unsigned long mask;
+    printf("PLACEMENT: nodes=%d memory=%s threads=", placement_nodes(&mask),
+            loaded ? "loader" : interleave ? "interleave" : "first-touch");
+    if (!placement_pinned) {
+        printf("unpinned\n");
+        return;
+    }
+    for (int t = 0; t < threads && t < PLACEMENT_MAX_THREADS; t++) {
+        printf("%s%d@%d", t > 0 ? "," : "", placement_cpus[t],
+                placement_node_of(placement_cpus[t]));
+    }
+    printf("\n");
+}
+
+#endif  // PLACEMENT_H
@@ -2,6 +2,7 @@
 #include <limits.h>
 #include <math.h>
 #include <pthread.h>
+#include <sched.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -11,41 +12,188 @@
 
 #include "timer.h"
 
+// vectorized row update and dot product kernels
+#include "simd.h"
+
+// binary (memory-mapped) matrix file format
+#include "matrix_io.h"
+
+// counter-based random numbers for generated systems
+#include "rng.h"
+
+// entry point for the benchmark driver (library builds)
+#include "bench.h"
+
+// NUMA-aware allocation and thread pinning
+#include "placement.h"
+
+// work-stealing deques for the pool's row tasks
+#include "worksteal.h"
+
 // uncomment this line to enable the alternative back substitution method
 /*#define USE_COLUMN_BACKSUB*/
 
 // use 64-bit IEEE arithmetic (change to "float" to use 32-bit arithmetic)
 #define REAL double
 
-// linear system: Ax = b    (A is n x n matrix; b and x are n x 1 vectors)
+// linear system: Ax = b    (A is n x n matrix; b and x are n x nrhs matrices
+// stored row-major, one column per right-hand side)
 int n;
+int nrhs = 1;
 REAL *A;
+int lda;    // leading dimension (row stride) of A, padded (see matrix_alloc.h)
 REAL *x;
 REAL *b;
 
+// mapping of A and b when the system was loaded from a binary file
+matrix_map_t mapped_system;
+
+// row permutation from partial pivoting: logical row i of A and b is stored
+// in physical row perm[i] (identity unless pivoting is enabled)
+int *perm;
+
 // enable/disable debugging output (don't enable for large matrix sizes!)
 bool debug_mode = false;
 
 // enable/disable triangular mode (to skip the Gaussian elimination phase)
 bool triangular_mode = false;
 
+// enable/disable partial pivoting
+bool pivot_mode = false;
+
+// enable/disable fused generate-and-eliminate mode (random systems only)
+bool fused_mode = false;
+
+// pin each thread to its own CPU
+bool pin_mode = false;
+
+// interleave A over all NUMA nodes instead of placing it by first touch
+bool interleave_mode = false;
+
+// true if the system was read from a file (A keeps the placement of the loader)
+bool loaded_system = false;
+
+// first pivot left for Gaussian elimination (1 if the first pivot was already
+// eliminated while the system was generated)
+int first_pivot = 0;
+
 int numThreads;
 
 typedef struct {
+    int tid;
     int startRow;
     int endRow;
     int pivot;
+    REAL maxVal;    // largest |A| in the next pivot column among this
+    int maxRow;     // thread's rows, and the (logical) row it is in
 } ThreadData;
 
-pthread_mutex_t mutex_sum;
-REAL *partial_sums;
-
 typedef struct {
-    int startCol;
-    int endCol;
-    int row;
+    int tid;
 } BackSubData;
 
+// synchronizes the pool threads before the pipelined back substitution
+pthread_barrier_t bsub_barrier;
+
+// state of one block of BSUB_BLOCK rows in the back substitution, padded to
+// a cache line so that threads working on different blocks don't contend
+typedef struct {
+    int busy;       // set while a thread is updating or solving the block
+    int applied;    // number of solved blocks below it applied so far
+} __attribute__((aligned(64))) BackSubBlock;
+
+BackSubBlock *bsub_blocks;
+int bsub_nblocks;
+int bsub_solved;    // blocks solved so far, bottom up (updated atomically)
+
+// rows per diagonal block in the blocked back substitution
+#define BSUB_BLOCK 64
+
+// pivots per block in the elimination profile (see timer.h)
+#define PROFILE_BLOCK 64
+
+// rows per work-stealing task
+#define STEAL_TILE 8
+
+// per-thread task deques (see worksteal.h)
+ws_sched_t sched;
+
+/*
+ * Persistent worker pool. The numThreads-1 worker threads are created once
+ * and parked on a barrier between jobs; the main thread acts as worker 0.
+ * A job is a start routine plus an array of per-thread arguments, just like
+ * a round of pthread_create()/pthread_join() calls.
+ */
+pthread_t *pool_threads;
+pthread_barrier_t pool_start;
+pthread_barrier_t pool_done;
+void *(*pool_func)(void *);
+char *pool_args;
+size_t pool_arg_size;
+bool pool_shutdown = false;
+int pool_block = -1;    // pivot block of the current job (for the profile)
+
+void *pool_worker(void *arg) {
+    long tid = (long)arg;
+    if (pin_mode) {
+        placement_pin(tid);
+    }
+    while (true) {
+        pthread_barrier_wait(&pool_start);
+        if (pool_shutdown) {
+            break;
+        }
+        pool_func(pool_args + tid * pool_arg_size);
+        PROFILE_SCOPE_BLOCK("barrier", pool_block);
+        pthread_barrier_wait(&pool_done);
+    }
+    return NULL;
+}
+
+void pool_init() {
+    pool_shutdown = false;
+    pool_threads = (pthread_t *)malloc(numThreads * sizeof(pthread_t));
+    pthread_barrier_init(&pool_start, NULL, numThreads);
+    pthread_barrier_init(&pool_done, NULL, numThreads);
+    ws_init(&sched, numThreads);
+    if (pin_mode) {
+        placement_init();
+        placement_pin(0);
+    }
+    for (long t = 1; t < numThreads; t++) {
+        if (pthread_create(&pool_threads[t], NULL, pool_worker, (void *)t)) {
+            fprintf(stderr, "Error creating thread\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+}
+
+/*
+ * Runs func on every thread of the pool (thread t gets &args[t]) and waits
+ * for all of them to finish.
+ */
+void pool_run(void *(*func)(void *), void *args, size_t arg_size) {
+    pool_func = func;
+    pool_args = (char *)args;
+    pool_arg_size = arg_size;
+    pthread_barrier_wait(&pool_start);
+    func(args);
+    PROFILE_SCOPE_BLOCK("barrier", pool_block);
+    pthread_barrier_wait(&pool_done);
+}
+
+void pool_destroy() {
+    pool_shutdown = true;
+    pthread_barrier_wait(&pool_start);
+    for (int t = 1; t < numThreads; t++) {
+        pthread_join(pool_threads[t], NULL);
+    }
+    pthread_barrier_destroy(&pool_start);
+    pthread_barrier_destroy(&pool_done);
+    ws_destroy(&sched);
+    free(pool_threads);
+}
+
 /*
  * Prints a matrix to standard output in a fixed-width format.
  */
@@ -59,208 +207,512 @@ void print_matrix(REAL *mat, int rows, int cols)
     }
 }
 
+/*
+ * Prints a matrix stored with the row permutation in logical row order.
+ */
+void print_permuted_matrix(REAL *mat, int rows, int cols, int ld)
+{
+    for (int row = 0; row < rows; row++) {
+        for (int col = 0; col < cols; col++) {
+            printf("%8.1e ", mat[perm[row]*ld + col]);
+        }
+        printf("\n");
+    }
+}
+
+/*
+ * Splits rows firstRow..n-1 evenly across the threads.
+ */
+void partition_rows(ThreadData *data, int firstRow, int pivot) {
+    int rowsPerThread = (n - firstRow) / numThreads;
+    int extra = (n - firstRow) % numThreads;
+
+    int currentStartRow = firstRow;
+    for (int t = 0; t < numThreads; t++) {
+        int rowsToHandle = rowsPerThread + (t < extra ? 1 : 0);
+        data[t].startRow = currentStartRow;
+        data[t].endRow = currentStartRow + rowsToHandle;
+        data[t].pivot = pivot;
+        currentStartRow += rowsToHandle;
+    }
+}
+
+/*
+ * Prepares a work-stealing job over rows firstRow..n-1: the rows are split
+ * into tasks of STEAL_TILE rows, and each thread starts out with its
+ * contiguous share of them (as in partition_rows()).
+ */
+void steal_rows(ThreadData *data, int firstRow, int pivot) {
+    for (int t = 0; t < numThreads; t++) {
+        data[t].tid = t;
+        data[t].startRow = firstRow;
+        data[t].endRow = n;
+        data[t].pivot = pivot;
+    }
+    ws_fill(&sched, (n - firstRow + STEAL_TILE - 1) / STEAL_TILE);
+}
+
+/*
+ * Gets the rows [*r0, *r1) of thread tid's next task from a job prepared by
+ * steal_rows() (or with ws_fill() for rows firstRow..lastRow-1). Returns
+ * false when the job is done.
+ */
+bool next_rows(int tid, int firstRow, int lastRow, int *r0, int *r1) {
+    int task;
+    if (!ws_next(&sched, tid, &task)) {
+        return false;
+    }
+    *r0 = firstRow + task * STEAL_TILE;
+    *r1 = (*r0 + STEAL_TILE < lastRow) ? *r0 + STEAL_TILE : lastRow;
+    return true;
+}
+
+void *clear_rows_thread(void *arg) {
+    ThreadData *data = (ThreadData *)arg;
+    for (int row = data->startRow; row < data->endRow; row++) {
+        memset(&A[(size_t)row * lda], 0, lda * sizeof(REAL));
+    }
+    return NULL;
+}
+
+/*
+ * Allocates (zero-filled) space for a generated system, with A's rows padded
+ * to the leading dimension lda. A is cleared by the pool with the same row
+ * partition as elimination uses, so each row's pages are first touched (and
+ * placed on the NUMA node of) the thread that will update them.
+ */
+void alloc_system() {
+    lda = matrix_lda(n, sizeof(REAL));
+    A = (REAL*)placement_alloc((size_t)n * lda * sizeof(REAL), interleave_mode);
+    b = (REAL*)calloc(n * nrhs, sizeof(REAL));
+    x = (REAL*)calloc(n * nrhs, sizeof(REAL));
+    if (A == NULL || b == NULL || x == NULL) {
+        fprintf(stderr, "Memory allocation failed\n");
+        exit(EXIT_FAILURE);
+    }
+
+    ThreadData *data = (ThreadData *)malloc(numThreads * sizeof(ThreadData));
+    partition_rows(data, 0, 0);
+    pool_run(clear_rows_thread, data, sizeof(ThreadData));
+    free(data);
+}
+
+/*
+ * Returns entry (row, col) of the random matrix. Each entry is a function of
+ * its row and column only, so the system doesn't depend on the number of
+ * threads (and matches the other backends).
+ */
+REAL rand_entry(int row, int col) {
+    if (row == col) {
+        return n / 10.0;
+    }
+    return (REAL)rand_u31(RAND_SEED, row, col) / (REAL)ULONG_MAX;
+}
+
+/*
+ * Generates one row of the random system: the entries of A and right-hand
+ * sides such that column j of the solution is all (j+1)s.
+ */
+void rand_row(int row) {
+    int colStart = triangular_mode ? row : 0;
+    for (int col = colStart; col < n; col++) {
+        A[row * lda + col] = rand_entry(row, col);
+    }
+    REAL sum = 0.0;
+    for (int col = 0; col < n; col++) {
+        sum += A[row * lda + col] * 1.0;
+    }
+    for (int j = 0; j < nrhs; j++) {
+        b[row * nrhs + j] = sum * (j + 1);
+    }
+}
+
 void *rand_system_thread(void *arg) {
     ThreadData *data = (ThreadData *)arg;
-    int startRow = data->startRow;
-    int endRow = data->endRow;
-    unsigned long seed = data->startRow; 
-
-    for (int row = startRow; row < endRow; row++) {
-        int colStart = triangular_mode ? row : 0;
-        for (int col = colStart; col < n; col++) {
-            if (row != col) {
-                seed = (1103515245 * seed + 12345) % (1 << 31);
-                A[row * n + col] = (REAL)seed / (REAL)ULONG_MAX;
-            } else {
-                A[row * n + col] = n / 10.0;
-            }
-        }
-        b[row] = 0.0;
-        for (int col = 0; col < n; col++) {
-            b[row] += A[row * n + col] * 1.0;
+    int r0, r1;
+    while (next_rows(data->tid, data->startRow, data->endRow, &r0, &r1)) {
+        for (int row = r0; row < r1; row++) {
+            rand_row(row);
         }
     }
-
-    pthread_exit(NULL);
+    return NULL;
 }
 
 void rand_system_parallel() {
-    pthread_t *threads = new pthread_t[numThreads];
+    // each thread starts with the rows it first touched in alloc_system(),
+    // and steals others' rows once it is done
     ThreadData *data = new ThreadData[numThreads];
-    int chunkSize = (n + numThreads - 1) / numThreads;
+    steal_rows(data, 0, 0);
+    pool_run(rand_system_thread, data, sizeof(ThreadData));
 
-    for (int t = 0; t < numThreads; t++) {
-        data[t].startRow = t * chunkSize;
-        data[t].endRow = std::fmin((t + 1) * chunkSize, n);
-        pthread_create(&threads[t], NULL, rand_system_thread, (void *)&data[t]);
+    delete[] data;
+}
+
+/*
+ * Generates this thread's rows (logical rows startRow..endRow-1, all below
+ * the first pivot) and eliminates the first pivot from each one while it is
+ * still in cache.
+ */
+void *rand_system_fused_thread(void *arg) {
+    ThreadData *data = (ThreadData *)arg;
+    int prow = perm[0];
+    for (int row = data->startRow; row < data->endRow; row++) {
+        int r = perm[row];
+        rand_row(r);
+        REAL coeff = A[r * lda] / A[prow * lda];
+        A[r * lda] = coeff;
+        row_update(&A[r * lda + 1], &A[prow * lda + 1], coeff, n - 1);
+        row_update(&b[r * nrhs], &b[prow * nrhs], coeff, nrhs);
     }
+    return NULL;
+}
 
-    for (int t = 0; t < numThreads; t++) {
-        pthread_join(threads[t], NULL);
+/*
+ * Generates the same system as rand_system_parallel() with the first pivot
+ * already eliminated, so the original A never has to be written out and read
+ * back. Elimination then starts at the second pivot.
+ */
+void rand_system_fused_parallel() {
+    // with pivoting, pick the first pivot from column 0 (generated directly)
+    if (pivot_mode) {
+        int best = 0;
+        REAL bestVal = fabs(rand_entry(0, 0));
+        for (int row = 1; row < n; row++) {
+            REAL val = fabs(rand_entry(row, 0));
+            if (val > bestVal) {
+                best = row;
+                bestVal = val;
+            }
+        }
+        if (bestVal == 0.0) {
+            fprintf(stderr, "Matrix is singular\n");
+            exit(EXIT_FAILURE);
+        }
+        perm[best] = perm[0];
+        perm[0] = best;
     }
+    rand_row(perm[0]);
 
-    delete[] threads;
-    delete[] data;
+    ThreadData *data = (ThreadData *)malloc(numThreads * sizeof(ThreadData));
+    partition_rows(data, 1, 0);
+    pool_run(rand_system_fused_thread, data, sizeof(ThreadData));
+    free(data);
+    first_pivot = 1;
 }
 
 
 /*
  * Reads a linear system of equations from a file in the form of an augmented
- * matrix [A][b].
+ * matrix [A][b] (each row holds n entries of A followed by nrhs entries of b),
+ * or maps it from a file in the binary format (see matrix_io.h).
  */
 void read_system(const char *fn)
 {
-    // open file and read matrix dimensions
-    FILE* fin = fopen(fn, "r");
-    if (fin == NULL) {
-        printf("Unable to open file \"%s\"\n", fn);
-        exit(EXIT_FAILURE);
-    }
-    if (fscanf(fin, "%d\n", &n) != 1) {
-        printf("Invalid matrix file format\n");
-        exit(EXIT_FAILURE);
+    loaded_system = true;
+
+    // binary files are mapped and used in place
+    if (matrix_map(fn, nrhs, sizeof(REAL), &mapped_system)) {
+        n = mapped_system.n;
+        lda = n;
+        A = (REAL*)mapped_system.A;
+        b = (REAL*)mapped_system.b;
+        x = (REAL*)calloc(n*nrhs, sizeof(REAL));
+        if (x == NULL) {
+            printf("Unable to allocate memory for linear system\n");
+            exit(EXIT_FAILURE);
+        }
+        return;
     }
 
-    // allocate space for matrices
-    A = (REAL*)malloc(sizeof(REAL) * n*n);
-    b = (REAL*)malloc(sizeof(REAL) * n);
-    x = (REAL*)malloc(sizeof(REAL) * n);
-
-    // verify that memory allocation succeeded
-    if (A == NULL || b == NULL || x == NULL) {
+    // parse text file in parallel (the parser threads inherit the main
+    // thread's affinity, so unpin it meanwhile)
+    if (pin_mode) {
+        placement_unpin();
+    }
+    matrix_read_text(fn, nrhs, numThreads, &n, &A, &b, &lda);
+    if (pin_mode) {
+        placement_pin(0);
+    }
+    x = (REAL*)calloc(n*nrhs, sizeof(REAL));
+    if (x == NULL) {
         printf("Unable to allocate memory for linear system\n");
         exit(EXIT_FAILURE);
     }
+}
 
-    // read all values
+/*
+ * Allocates the row permutation and initializes it to the identity.
+ */
+void init_permutation() {
+    perm = (int *)malloc(n * sizeof(int));
+    if (perm == NULL) {
+        fprintf(stderr, "Memory allocation failed\n");
+        exit(EXIT_FAILURE);
+    }
     for (int row = 0; row < n; row++) {
-        for (int col = 0; col < n; col++) {
-            if (fscanf(fin, "%lf", &A[row*n + col]) != 1) {
-                printf("Invalid matrix file format\n");
-                exit(EXIT_FAILURE);
-            }
+        perm[row] = row;
+    }
+}
+
+/*
+ * Finds the largest |A| in the pivot column among this thread's rows.
+ */
+void *pivot_search_thread(void *arg) {
+    ThreadData *data = (ThreadData *)arg;
+    data->maxVal = -1.0;
+    data->maxRow = -1;
+    for (int row = data->startRow; row < data->endRow; row++) {
+        REAL val = fabs(A[perm[row] * lda + data->pivot]);
+        if (val > data->maxVal) {
+            data->maxVal = val;
+            data->maxRow = row;
         }
-        if (fscanf(fin, "%lf", &b[row]) != 1) {
-            printf("Invalid matrix file format\n");
-            exit(EXIT_FAILURE);
+    }
+    return NULL;
+}
+
+/*
+ * Partial pivoting: combines the per-thread candidates (breaking ties
+ * towards the lower row, so the choice doesn't depend on which thread
+ * processed which rows) and moves the winner into the pivot position.
+ * Rows are swapped in the permutation only; A and b are never copied.
+ */
+void swap_pivot(ThreadData *data, int pivot) {
+    REAL maxVal = -1.0;
+    int maxRow = pivot;
+    for (int t = 0; t < numThreads; t++) {
+        if (data[t].maxRow < 0) {
+            continue;
+        }
+        if (data[t].maxVal > maxVal || (data[t].maxVal == maxVal && data[t].maxRow < maxRow)) {
+            maxVal = data[t].maxVal;
+            maxRow = data[t].maxRow;
         }
-        x[row] = 0.0;  
     }
-    fclose(fin);
+    if (maxVal == 0.0) {
+        fprintf(stderr, "Matrix is singular\n");
+        exit(EXIT_FAILURE);
+    }
+    int tmp = perm[pivot];
+    perm[pivot] = perm[maxRow];
+    perm[maxRow] = tmp;
 }
 
 void *gaussian_elimination_thread(void *arg) {
     ThreadData *data = (ThreadData *)arg;
-    int startRow = data->startRow;
-    int endRow = data->endRow;
     int pivot = data->pivot;
-
-    for (int row = startRow; row < endRow; row++) {
-        REAL coeff = A[row * n + pivot] / A[pivot * n + pivot];
-        for (int col = pivot; col < n; col++) {
-            A[row * n + col] -= coeff * A[pivot * n + col];
+    int prow = perm[pivot];
+    PROFILE_SCOPE_BLOCK("update", pivot / PROFILE_BLOCK);
+
+    // track the next pivot candidate while the rows are still in cache
+    data->maxVal = -1.0;
+    data->maxRow = -1;
+
+    int r0, r1;
+    while (next_rows(data->tid, data->startRow, data->endRow, &r0, &r1)) {
+        for (int row = r0; row < r1; row++) {
+            int r = perm[row];
+            REAL coeff = A[r * lda + pivot] / A[prow * lda + pivot];
+            A[r * lda + pivot] = coeff;   // keep the multiplier (L below the diagonal)
+            row_update(&A[r * lda + pivot + 1], &A[prow * lda + pivot + 1], coeff, n - pivot - 1);
+            row_update(&b[r * nrhs], &b[prow * nrhs], coeff, nrhs);
+
+            // stolen tasks come in any order, so break ties explicitly
+            REAL val = fabs(A[r * lda + pivot + 1]);
+            if (val > data->maxVal || (val == data->maxVal && row < data->maxRow)) {
+                data->maxVal = val;
+                data->maxRow = row;
+            }
         }
-        b[row] -= coeff * b[pivot];
     }
-    pthread_exit(NULL);
+    return NULL;
 }
 
 void gaussian_elimination() {
-    pthread_t *threads = (pthread_t *)malloc(numThreads * sizeof(pthread_t));
     ThreadData *data = (ThreadData *)malloc(numThreads * sizeof(ThreadData));
 
-    for (int pivot = 0; pivot < n; pivot++) {
-        int rowsPerThread = (n - pivot - 1) / numThreads;
-        int extra = (n - pivot - 1) % numThreads;
-
-        int currentStartRow = pivot + 1;
-        for (int t = 0; t < numThreads; t++) {
-            int rowsToHandle = rowsPerThread + (t < extra ? 1 : 0);
-            data[t].startRow = currentStartRow;
-            data[t].endRow = currentStartRow + rowsToHandle;
-            data[t].pivot = pivot;
+    if (pivot_mode && first_pivot < n) {
+        partition_rows(data, first_pivot, first_pivot);
+        pool_run(pivot_search_thread, data, sizeof(ThreadData));
+    }
 
-            if (pthread_create(&threads[t], NULL, gaussian_elimination_thread, (void *)&data[t])) {
-                fprintf(stderr, "Error creating thread\n");
-                exit(EXIT_FAILURE);
-            }
-            currentStartRow += rowsToHandle;
+    for (int pivot = first_pivot; pivot < n; pivot++) {
+        // the candidates come from the previous round of row updates
+        if (pivot_mode) {
+            swap_pivot(data, pivot);
         }
+        steal_rows(data, pivot + 1, pivot);
+        pool_block = pivot / PROFILE_BLOCK;
+        pool_run(gaussian_elimination_thread, data, sizeof(ThreadData));
+    }
+    pool_block = -1;
+    free(data);
+}
 
-        for (int t = 0; t < numThreads; t++) {
-            pthread_join(threads[t], NULL);
+/*
+ * Performs backwards substitution on the linear system.
+ * (column-oriented version)
+ */
+void back_substitution_column()
+{
+    for (int row = 0; row < n; row++) {
+        x[row] = b[perm[row]];
+    }
+    for (int col = n-1; col >= 0; col--) {
+        x[col] /= A[perm[col]*lda + col];
+        for (int row = 0; row < col; row++) {
+            x[row] += -A[perm[row]*lda + col] * x[col];
         }
     }
-    free(threads);
-    free(data);
 }
 
-void *back_substitution_thread(void *arg) {
-    BackSubData *data = (BackSubData *)arg;
-    REAL sum = 0.0;
-    for (int col = data->startCol; col < data->endCol; col++) {
-        sum += A[data->row * n + col] * x[col];
+/*
+ * Solves the diagonal block of rows [i0, i1) for x, once the rows below it
+ * have been applied.
+ */
+void solve_diagonal_block(int i0, int i1)
+{
+    for (int row = i1-1; row >= i0; row--) {
+        int r = perm[row];
+        if (nrhs == 1) {
+            x[row] = (x[row] - dot(&A[r*lda + row+1], &x[row+1], i1 - row - 1)) / A[r*lda + row];
+        } else {
+            for (int col = row+1; col < i1; col++) {
+                row_update(&x[row*nrhs], &x[col*nrhs], A[r*lda + col], nrhs);
+            }
+            for (int j = 0; j < nrhs; j++) {
+                x[row*nrhs + j] /= A[r*lda + row];
+            }
+        }
     }
+}
 
-    pthread_mutex_lock(&mutex_sum);
-    partial_sums[data->row] += sum;
-    pthread_mutex_unlock(&mutex_sum);
+/*
+ * Applies the solved rows [i0, i1) to a row above them (one row of the
+ * matrix-vector product with the block of A in columns [i0, i1)).
+ */
+void apply_block_to_row(int row, int i0, int i1)
+{
+    int r = perm[row];
+    if (nrhs == 1) {
+        x[row] -= dot(&A[r*lda + i0], &x[i0], i1 - i0);
+    } else {
+        for (int col = i0; col < i1; col++) {
+            row_update(&x[row*nrhs], &x[col*nrhs], A[r*lda + col], nrhs);
+        }
+    }
+}
 
-    pthread_exit(NULL);
+/*
+ * Rows [*i0, *i1) of block k (block 0 is the bottom one).
+ */
+void bsub_block_rows(int k, int *i0, int *i1) {
+    *i1 = n - k * BSUB_BLOCK;
+    *i0 = (*i1 - BSUB_BLOCK > 0) ? *i1 - BSUB_BLOCK : 0;
 }
 
-void back_substitution_row() {
-    pthread_t *threads = (pthread_t *)malloc(numThreads * sizeof(pthread_t));
-    BackSubData *thread_data = (BackSubData *)malloc(numThreads * sizeof(BackSubData));
-    partial_sums = (REAL *)calloc(n, sizeof(REAL));
+/*
+ * Brings block k up to date if no other thread is working on it: applies
+ * the solved blocks below it that it hasn't seen yet and, if it is the next
+ * block to solve, solves it. Returns true if it did any work.
+ */
+bool bsub_advance_block(int k) {
+    BackSubBlock *blk = &bsub_blocks[k];
+    int solved = __atomic_load_n(&bsub_solved, __ATOMIC_ACQUIRE);
+    if (__atomic_load_n(&blk->applied, __ATOMIC_RELAXED) >= (solved < k ? solved : k) &&
+            solved != k) {
+        return false;   // nothing new to apply
+    }
+    if (__atomic_exchange_n(&blk->busy, 1, __ATOMIC_ACQUIRE)) {
+        return false;
+    }
 
-    pthread_mutex_init(&mutex_sum, NULL);
+    int i0, i1;
+    bsub_block_rows(k, &i0, &i1);
+    solved = __atomic_load_n(&bsub_solved, __ATOMIC_ACQUIRE);
+    bool worked = false;
+    while (blk->applied < solved && blk->applied < k) {
+        int j0, j1;
+        bsub_block_rows(blk->applied, &j0, &j1);
+        for (int row = i0; row < i1; row++) {
+            apply_block_to_row(row, j0, j1);
+        }
+        __atomic_store_n(&blk->applied, blk->applied + 1, __ATOMIC_RELAXED);
+        worked = true;
+    }
+    if (solved == k && blk->applied == k) {
+        solve_diagonal_block(i0, i1);
+        __atomic_store_n(&bsub_solved, k + 1, __ATOMIC_RELEASE);
+        worked = true;
+    }
 
-    for (int row = n-1; row >= 0; row--) {
-        int remainingCols = n - row - 1;
-        int colsPerThread = remainingCols / numThreads;
-        int extra = remainingCols % numThreads;
+    __atomic_store_n(&blk->busy, 0, __ATOMIC_RELEASE);
+    return worked;
+}
 
-        int startCol = row + 1;
-        for (int t = 0; t < numThreads; t++) {
-            thread_data[t].row = row;
-            thread_data[t].startCol = startCol;
-            thread_data[t].endCol = startCol + colsPerThread + (t < extra ? 1 : 0);
-            pthread_create(&threads[t], NULL, back_substitution_thread, &thread_data[t]);
-            startCol = thread_data[t].endCol;
+void *back_substitution_thread(void *arg) {
+    int tid = ((BackSubData *)arg)->tid;
+    int r0, r1;
+
+    // the tasks for copying b were queued before the job started
+    while (next_rows(tid, 0, n, &r0, &r1)) {
+        for (int row = r0; row < r1; row++) {
+            for (int j = 0; j < nrhs; j++) {
+                x[row * nrhs + j] = b[perm[row] * nrhs + j];
+            }
         }
-
-        for (int t = 0; t < numThreads; t++) {
-            pthread_join(threads[t], NULL);
+    }
+    pthread_barrier_wait(&bsub_barrier);
+
+    // the next block to solve comes first; the rest are visited starting at
+    // a different block in each thread, to spread the threads out
+    int solved;
+    while ((solved = __atomic_load_n(&bsub_solved, __ATOMIC_ACQUIRE)) < bsub_nblocks) {
+        bool worked = bsub_advance_block(solved);
+        int pending = bsub_nblocks - solved - 1;
+        for (int i = 0; i < pending; i++) {
+            int k = solved + 1 + (tid + i) % pending;
+            worked |= bsub_advance_block(k);
+        }
+        if (!worked) {
+            sched_yield();
         }
-
-        // Calculate x[row] after all threads are done updating partial sums
-        x[row] = (b[row] - partial_sums[row]) / A[row * n + row];
-        partial_sums[row] = 0.0;
     }
-
-    free(threads);
-    free(thread_data);
-    free(partial_sums);
-    pthread_mutex_destroy(&mutex_sum);
+    return NULL;
 }
 
-
 /*
- * Performs backwards substitution on the linear system.
- * (column-oriented version)
+ * Performs backwards substitution for all nrhs right-hand sides as a blocked,
+ * pipelined triangular solve in a single pool job. The rows are split into
+ * blocks of BSUB_BLOCK rows. Each block takes the updates from the solved
+ * blocks below it (a matrix-vector product each) one after another, and is
+ * solved as soon as the last of them has been applied, while the threads go
+ * on applying it to the blocks above. Threads claim blocks with an atomic
+ * flag instead of meeting at barriers, so a block is solved as soon as its
+ * own rows are ready and a slow thread only holds up the block it is
+ * working on. Every row takes its updates in the same order whichever
+ * thread applies them, so the result is deterministic.
  */
-void back_substitution_column()
-{
-    for (int row = 0; row < n; row++) {
-        x[row] = b[row];
+void back_substitution_blocked() {
+    BackSubData *data = (BackSubData *)malloc(numThreads * sizeof(BackSubData));
+    for (int t = 0; t < numThreads; t++) {
+        data[t].tid = t;
     }
-    for (int col = n-1; col >= 0; col--) {
-        x[col] /= A[col*n + col];
-        for (int row = 0; row < col; row++) {
-            x[row] += -A[row*n + col] * x[col];
-        }
+    bsub_nblocks = (n + BSUB_BLOCK - 1) / BSUB_BLOCK;
+    bsub_blocks = (BackSubBlock *)aligned_alloc(64, bsub_nblocks * sizeof(BackSubBlock));
+    if (data == NULL || bsub_blocks == NULL) {
+        fprintf(stderr, "Memory allocation failed\n");
+        exit(EXIT_FAILURE);
     }
+    memset(bsub_blocks, 0, bsub_nblocks * sizeof(BackSubBlock));
+    bsub_solved = 0;
+
+    pthread_barrier_init(&bsub_barrier, NULL, numThreads);
+    ws_fill(&sched, (n + STEAL_TILE - 1) / STEAL_TILE);
+    pool_run(back_substitution_thread, data, sizeof(BackSubData));
+    pthread_barrier_destroy(&bsub_barrier);
+    free(bsub_blocks);
+    free(data);
 }
 
 /*
@@ -271,29 +723,61 @@ REAL find_max_error()
 {
     REAL error = 0.0, tmp;
     for (int row = 0; row < n; row++) {
-        tmp = fabs(x[row] - 1.0);
-        if (tmp > error) {
-            error = tmp;
+        for (int j = 0; j < nrhs; j++) {
+            tmp = fabs(x[row*nrhs + j] - (j+1));
+            if (tmp > error) {
+                error = tmp;
+            }
         }
     }
     return error;
 }
 
-int main(int argc, char *argv[])
+/*
+ * Runs the program with the given command line. If result is not NULL (when
+ * called by the benchmark driver), the error and phase times are stored there
+ * instead of being printed.
+ */
+int run(int argc, char *argv[], bench_result_t *result)
 {
+    // reset the options, since the benchmark driver calls run() repeatedly
+    optind = 1;
+    nrhs = 1;
+    debug_mode = triangular_mode = pivot_mode = fused_mode = false;
+    pin_mode = interleave_mode = false;
+    first_pivot = 0;
     numThreads = 4;
 
     int c;
-    while ((c = getopt(argc, argv, "dt")) != -1) {
+    while ((c = getopt(argc, argv, "adfik:pt")) != -1) {
         switch (c) {
+        case 'a':
+            pin_mode = true;
+            break;
         case 'd':
             debug_mode = true;
             break;
+        case 'f':
+            fused_mode = true;
+            break;
+        case 'i':
+            interleave_mode = true;
+            break;
+        case 'k':
+            nrhs = (int)strtol(optarg, NULL, 10);
+            if (nrhs <= 0) {
+                fprintf(stderr, "Invalid number of right-hand sides: %s\n", optarg);
+                exit(EXIT_FAILURE);
+            }
+            break;
+        case 'p':
+            pivot_mode = true;
+            break;
         case 't':
             triangular_mode = true;
             break;
         default:
-            fprintf(stderr, "Usage: %s [-dt] <file|size> [numThreads]\n", argv[0]);
+            fprintf(stderr, "Usage: %s [-adfipt] [-k <nrhs>] <file|size> [numThreads]\n", argv[0]);
             exit(EXIT_FAILURE);
         }
     }
@@ -324,35 +808,37 @@ int main(int argc, char *argv[])
             exit(EXIT_FAILURE);
         }
     } else if (argc - optind != 1) {
-        fprintf(stderr, "Usage: %s [-dt] <file|size> [numThreads]\n", argv[0]);
+        fprintf(stderr, "Usage: %s [-adfipt] [-k <nrhs>] <file|size> [numThreads]\n", argv[0]);
         exit(EXIT_FAILURE);
     }
 
+    // start the worker pool once; every parallel phase reuses it
+    pool_init();
+
     long int size = strtol(argv[optind], NULL, 10);
     START_TIMER(init)
     if (size == 0) {
         read_system(argv[optind]);
+        init_permutation();
     } else {
         n = (int)size;
-        // Allocate memory for A, b, and x
-        A = (REAL*)calloc(n * n, sizeof(REAL));
-        b = (REAL*)calloc(n, sizeof(REAL));
-        x = (REAL*)calloc(n, sizeof(REAL));
-        // Check for memory allocation success
-        if (A == NULL || b == NULL || x == NULL) {
-            fprintf(stderr, "Memory allocation failed\n");
-            exit(EXIT_FAILURE);
+        init_permutation();
+        alloc_system();
+        // Initialize the system in parallel
+        if (fused_mode && !triangular_mode) {
+            rand_system_fused_parallel();
+        } else {
+            rand_system_parallel();
         }
-        rand_system_parallel();  // Initialize the system in parallel
     }
 
     STOP_TIMER(init)
 
     if (debug_mode) {
-        printf("Original A = \n");
-        print_matrix(A, n, n);
-        printf("Original b = \n");
-        print_matrix(b, n, 1);
+        printf(first_pivot ? "A after the first pivot = \n" : "Original A = \n");
+        print_permuted_matrix(A, n, n, lda);
+        printf(first_pivot ? "b after the first pivot = \n" : "Original b = \n");
+        print_permuted_matrix(b, n, nrhs, nrhs);
     }
 
     // perform gaussian elimination
@@ -364,30 +850,72 @@ int main(int argc, char *argv[])
 
     // perform backwards substitution
     START_TIMER(bsub)
-#   ifndef USE_COLUMN_BACKSUB
-    back_substitution_row();
+#   ifdef USE_COLUMN_BACKSUB
+    if (nrhs == 1) {
+        back_substitution_column();
+    } else {
+        back_substitution_blocked();
+    }
 #   else
-    back_substitution_column();
+    back_substitution_blocked();
 #   endif
     STOP_TIMER(bsub)
 
     if (debug_mode) {
-        printf("Triangular A = \n");
-        print_matrix(A, n, n);
+        printf("Factored A (L below the diagonal, U on and above) = \n");
+        print_permuted_matrix(A, n, n, lda);
         printf("Updated b = \n");
-        print_matrix(b, n, 1);
+        print_permuted_matrix(b, n, nrhs, nrhs);
         printf("Solution x = \n");
-        print_matrix(x, n, 1);
+        print_matrix(x, n, nrhs);
     }
 
-    // print results
-    printf("Nthreads=%2d  ERR=%8.1e  INIT: %8.4fs  GAUS: %8.4fs  BSUB: %8.4fs\n",
-            1, find_max_error(),
-            GET_TIMER(init), GET_TIMER(gaus), GET_TIMER(bsub));
+    // print results (or return them to the benchmark driver)
+    if (result != NULL) {
+        result->threads = numThreads;
+        result->err = find_max_error();
+        result->init = GET_TIMER(init);
+        result->gaus = GET_TIMER(gaus);
+        result->bsub = GET_TIMER(bsub);
+    } else {
+        printf("Nthreads=%2d  ERR=%8.1e  INIT: %8.4fs  GAUS: %8.4fs  BSUB: %8.4fs\n",
+                1, find_max_error(),
+                GET_TIMER(init), GET_TIMER(gaus), GET_TIMER(bsub));
+
+        // report thread and memory placement (if either was requested)
+        if (pin_mode || interleave_mode) {
+            placement_report(numThreads, interleave_mode, loaded_system);
+        }
+
+        // print per-phase hardware counters (if enabled with TIMER_COUNTERS)
+        perf_report(GET_COUNTERS(init), GET_TIMER(init), GET_COUNTERS(gaus), GET_TIMER(gaus),
+                GET_COUNTERS(bsub), GET_TIMER(bsub));
+    }
+
+    // write the profile (if enabled with TIMER_PROFILE)
+    profile_write();
 
     // clean up and exit
-    free(A);
-    free(b);
+    pool_destroy();
+    if (mapped_system.base != NULL) {
+        matrix_unmap(&mapped_system);
+    } else {
+        matrix_free(A);
+        free(b);
+    }
     free(x);
+    free(perm);
     return EXIT_SUCCESS;
-}
\ No newline at end of file
+}
+
+#ifdef LIBRARY_BUILD
+BENCH_EXPORT int bench_run(int argc, char *argv[], bench_result_t *result)
+{
+    return run(argc, argv, result);
+}
+#else
+int main(int argc, char *argv[])
+{
+    return run(argc, argv, NULL);
+}
+#endif
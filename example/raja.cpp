@@ -1,186 +1,407 @@
+#include <algorithm>
 #include <iostream>
 #include <vector>
 #include <cmath>
 #include <cstdlib>
 #include <cstring>
 #include <climits>
+#include <cstdint>
+#include <cstdio>
 #include <fstream>
 #include <getopt.h>
+#include <type_traits>
 #include "RAJA/RAJA.hpp"
 #include "timer.h"
-
-// Uncomment this line to enable the alternative back substitution method
-//#define USE_COLUMN_BACKSUB
-
-// Use 64-bit IEEE arithmetic (change to float to use 32-bit arithmetic)
-#define REAL double
+#include "solver.h"
 
 // Global timer variables
 double _timer_init, _timer_gaus, _timer_bsub;
 
-class LinearSystemSolver {
-public:
-    int n;
-    std::vector<REAL> A, x, b;
-    bool debug_mode = false;
-    bool triangular_mode = false;
-
-    LinearSystemSolver() : n(0) {}
-
-    void generateRandomSystem() {
-        A.resize(n * n);
-        b.resize(n);
-        x.resize(n, 0);
-
-        unsigned long seed = 0;
-        for (int row = 0; row < n; ++row) {
-            int colStart = triangular_mode ? row : 0;
-            for (int col = colStart; col < n; ++col) {
-                if (row != col) {
-                    seed = (1103515245 * seed + 12345) % (1UL << 31);
-                    A[row * n + col] = static_cast<REAL>(seed) / ULONG_MAX;
-                } else {
-                    A[row * n + col] = n / 10.0;
-                }
-            }
-        }
+// Tile size of the trailing submatrix update: RAJA_TILE_ROWS rows by
+// RAJA_TILE_COLS columns
+#define RAJA_TILE_ROWS 64
+#define RAJA_TILE_COLS 256
 
-        for (int row = 0; row < n; ++row) {
-            b[row] = 0.0;
-            for (int col = 0; col < n; ++col) {
-                b[row] += A[row * n + col];
-            }
-        }
+// Trailing submatrix update kernels for RAJA::kernel. Argument 0 is the row
+// and argument 1 a tile of RAJA_TILE_COLS columns, whose segment of the row
+// is updated with the vectorized row_update() from simd.h; each tile of
+// RAJA_TILE_ROWS rows reuses the same columns of the pivot row while they
+// are in cache. The simd policy uses the same kernel, since row_update() is
+// already vectorized.
+using SeqKernel = RAJA::KernelPolicy<
+    RAJA::statement::Tile<0, RAJA::tile_fixed<RAJA_TILE_ROWS>, RAJA::seq_exec,
+        RAJA::statement::For<1, RAJA::seq_exec,
+            RAJA::statement::For<0, RAJA::seq_exec,
+                RAJA::statement::Lambda<0>>>>>;
+
+// Tiles of rows are split over the threads
+using OmpKernel = RAJA::KernelPolicy<
+    RAJA::statement::Tile<0, RAJA::tile_fixed<RAJA_TILE_ROWS>, RAJA::omp_parallel_for_exec,
+        RAJA::statement::For<1, RAJA::seq_exec,
+            RAJA::statement::For<0, RAJA::seq_exec,
+                RAJA::statement::Lambda<0>>>>>;
+
+// Rows and column tiles form a single loop split over the threads, which
+// keeps every thread busy when only a few rows are left
+using CollapseKernel = RAJA::KernelPolicy<
+    RAJA::statement::Collapse<RAJA::omp_parallel_collapse_exec, RAJA::ArgList<0, 1>,
+        RAJA::statement::Lambda<0>>>;
+
+// Runs the solver's loops (see solver.h) with the given RAJA loop, reduction
+// and kernel policies. Reductions run with ReduceExec, which differs from
+// Exec only for simd (the lanes can't share a sequential reduction).
+template <typename Exec, typename Reduce, typename Kernel, typename ReduceExec = Exec>
+struct RajaPolicy {
+    static int threads() {
+        return std::is_same<Reduce, RAJA::omp_reduce>::value ? omp_get_max_threads() : 1;
     }
 
-    void readSystemFromFile(const std::string& filename) {
-        std::ifstream file(filename);
-        if (!file.is_open()) {
-            std::cerr << "Unable to open file \"" << filename << "\"\n";
-            exit(EXIT_FAILURE);
-        }
+    template <typename Body>
+    static void forall(int begin, int end, Body body) {
+        RAJA::forall<Exec>(RAJA::RangeSegment(begin, end), body);
+    }
 
-        file >> n;
+    template <typename T, typename Value>
+    static T maxloc(int begin, int end, Value value, int* loc) {
+        RAJA::ReduceMaxLoc<Reduce, T, int> best(-1.0, begin);
+        RAJA::forall<ReduceExec>(RAJA::RangeSegment(begin, end), [=](int i) {
+            best.maxloc(value(i), i);
+        });
+        *loc = best.getLoc();
+        return best.get();
+    }
 
-        A.resize(n * n);
-        b.resize(n);
-        x.resize(n, 0.0);
+    template <typename T, typename Value>
+    static T sum(int begin, int end, Value value) {
+        RAJA::ReduceSum<Reduce, T> total(0.0);
+        RAJA::forall<ReduceExec>(RAJA::RangeSegment(begin, end), [=](int i) {
+            total += value(i);
+        });
+        return total.get();
+    }
 
-        for (int row = 0; row < n; ++row) {
-            for (int col = 0; col < n; ++col) {
-                file >> A[row * n + col];
-            }
-            file >> b[row];
-        }
+    template <typename Body>
+    static void kernel(int rowBegin, int rowEnd, int colBegin, int colEnd, Body body) {
+        int tiles = (colEnd - colBegin + RAJA_TILE_COLS - 1) / RAJA_TILE_COLS;
+        RAJA::kernel<Kernel>(RAJA::make_tuple(RAJA::RangeSegment(rowBegin, rowEnd),
+                                              RAJA::RangeSegment(0, tiles)),
+                             [=](int row, int tile) {
+            int c0 = colBegin + tile * RAJA_TILE_COLS;
+            body(row, c0, std::min(c0 + RAJA_TILE_COLS, colEnd));
+        });
     }
+};
+
+using RajaSeqPolicy = RajaPolicy<RAJA::seq_exec, RAJA::seq_reduce, SeqKernel>;
+using RajaSimdPolicy = RajaPolicy<RAJA::simd_exec, RAJA::seq_reduce, SeqKernel, RAJA::seq_exec>;
+using RajaOmpPolicy = RajaPolicy<RAJA::omp_parallel_for_exec, RAJA::omp_reduce, OmpKernel>;
+using RajaCollapsePolicy = RajaPolicy<RAJA::omp_parallel_for_exec, RAJA::omp_reduce, CollapseKernel>;
 
-    void gaussianElimination() {
-        for (int pivot = 0; pivot < n; ++pivot) {
-            RAJA::forall<RAJA::omp_parallel_for_exec>(RAJA::RangeSegment(pivot + 1, n), [=](int row) {
-                REAL coeff = A[row * n + pivot] / A[pivot * n + pivot];
-                A[row * n + pivot] = 0.0;
-                for (int col = pivot + 1; col < n; ++col) {
-                    A[row * n + col] -= A[pivot * n + col] * coeff;
-                }
-                b[row] -= b[pivot] * coeff;
-            });
+// Runs the row loops and the tiles of the update as OpenMP tasks (RAJA has
+// no task policy for forall, so the tasks are created with taskloop and
+// each tile runs its rows with RAJA::forall). The reductions use the omp
+// policies.
+struct RajaTaskPolicy : RajaOmpPolicy {
+    template <typename Body>
+    static void forall(int begin, int end, Body body) {
+        #pragma omp parallel
+        #pragma omp single
+        #pragma omp taskloop grainsize(RAJA_TILE_ROWS)
+        for (int i = begin; i < end; ++i) {
+            body(i);
         }
     }
 
-    void backSubstitution() {
-        #ifndef USE_COLUMN_BACKSUB
-        for (int row = n - 1; row >= 0; --row) {
-            double sum = 0.0; // Temporary variable for local reduction
-            for (int col = row + 1; col < n; ++col) {
-                sum += A[row * n + col] * x[col];
+    template <typename Body>
+    static void kernel(int rowBegin, int rowEnd, int colBegin, int colEnd, Body body) {
+        #pragma omp parallel
+        #pragma omp single
+        #pragma omp taskloop collapse(2)
+        for (int r0 = rowBegin; r0 < rowEnd; r0 += RAJA_TILE_ROWS) {
+            for (int c0 = colBegin; c0 < colEnd; c0 += RAJA_TILE_COLS) {
+                int c1 = std::min(c0 + RAJA_TILE_COLS, colEnd);
+                RAJA::forall<RAJA::seq_exec>(
+                        RAJA::RangeSegment(r0, std::min(r0 + RAJA_TILE_ROWS, rowEnd)),
+                        [=](int row) {
+                    body(row, c0, c1);
+                });
             }
-            x[row] = (b[row] - sum) / A[row * n + row];
         }
-        #else
-        // Column-oriented code goes here
-        #endif
-}
+    }
+};
 
+// On-disk cache of LU factorizations keyed by a content hash of A, so that
+// repeated runs against the same coefficient matrix skip elimination
+class FactorizationCache {
+public:
+    explicit FactorizationCache(const std::string& dir) : dir(dir) {}
+
+    // FNV-1a hash of A (rows hashed in parallel, then combined in order),
+    // mixed with everything else that changes the factorization
+    template <typename T, typename Policy>
+    static uint64_t hashMatrix(const Solver<T, Policy>& solver) {
+        const int n = solver.n;
+        const int lda = solver.lda;
+        const T* A = solver.A.data();
+        std::vector<uint64_t> rowHash(n);
+        uint64_t* rh = rowHash.data();
+        Policy::forall(0, n, [=](int row) {
+            rh[row] = fnv1a(FNV_OFFSET, &A[(size_t)row * lda], sizeof(T) * n);
+        });
+
+        int params[3] = { n, (int)sizeof(T), solver.pivot_mode ? 1 : 0 };
+        uint64_t key = fnv1a(FNV_OFFSET, params, sizeof(params));
+        return fnv1a(key, rowHash.data(), sizeof(uint64_t) * n);
+    }
 
-    REAL findMaxError() const {
-        REAL maxError = 0.0;
-        for (int i = 0; i < n; ++i) {
-            REAL error = std::fabs(x[i] - 1.0);
-            if (error > maxError) maxError = error;
+    // Loads the factorization (LU factors and perm) for this key into the
+    // solver; returns false if it isn't cached
+    template <typename T, typename Policy>
+    bool load(Solver<T, Policy>& solver, uint64_t key) const {
+        std::ifstream file(path(key), std::ios::binary);
+        if (!file.is_open()) {
+            return false;
+        }
+        Header header;
+        file.read(reinterpret_cast<char*>(&header), sizeof(header));
+        if (!file || std::memcmp(header.magic, MAGIC, sizeof(header.magic)) != 0 ||
+                header.n != solver.n || header.elemSize != (int)sizeof(T) ||
+                header.key != key) {
+            return false;
         }
-        return maxError;
+        // Rows are stored unpadded in the file
+        std::vector<int> perm(solver.n);
+        std::vector<T, matrix_allocator<T>> A((size_t)solver.n * solver.lda);
+        file.read(reinterpret_cast<char*>(perm.data()), sizeof(int) * perm.size());
+        for (int row = 0; row < solver.n; ++row) {
+            file.read(reinterpret_cast<char*>(&A[(size_t)row * solver.lda]), sizeof(T) * solver.n);
+        }
+        if (!file) {
+            return false;
+        }
+        solver.perm.swap(perm);
+        solver.A.swap(A);
+        return true;
     }
 
-    void printMatrix(const std::vector<REAL>& mat, int rows, int cols) const {
-        for (int row = 0; row < rows; ++row) {
-            for (int col = 0; col < cols; ++col) {
-                std::cout << mat[row * cols + col] << " ";
-            }
-            std::cout << std::endl;
+    // Saves a factorization (written to a temporary file and renamed, so
+    // concurrent runs never see a partial entry)
+    template <typename T, typename Policy>
+    void save(const Solver<T, Policy>& solver, uint64_t key) const {
+        std::string final = path(key);
+        std::string tmp = final + ".tmp";
+        std::ofstream file(tmp, std::ios::binary);
+        if (!file.is_open()) {
+            std::cerr << "Unable to write factorization cache \"" << tmp << "\"\n";
+            return;
+        }
+        Header header;
+        std::memcpy(header.magic, MAGIC, sizeof(header.magic));
+        header.n = solver.n;
+        header.elemSize = sizeof(T);
+        header.key = key;
+        file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        file.write(reinterpret_cast<const char*>(solver.perm.data()), sizeof(int) * solver.perm.size());
+        for (int row = 0; row < solver.n; ++row) {
+            file.write(reinterpret_cast<const char*>(&solver.A[(size_t)row * solver.lda]), sizeof(T) * solver.n);
+        }
+        file.close();
+        if (!file || std::rename(tmp.c_str(), final.c_str()) != 0) {
+            std::cerr << "Unable to write factorization cache \"" << final << "\"\n";
+            std::remove(tmp.c_str());
         }
     }
-};
 
-int main(int argc, char* argv[]) {
-    LinearSystemSolver solver;
-    int option;
-    while ((option = getopt(argc, argv, "dt")) != -1) {
-        switch (option) {
-        case 'd':
-            solver.debug_mode = true;
-            break;
-        case 't':
-            solver.triangular_mode = true;
-            break;
-        default:
-            std::cout << "Usage: " << argv[0] << " [-dt] <file|size>\n";
-            return EXIT_FAILURE;
+private:
+    static constexpr const char* MAGIC = "LUCACHE1";
+    static const uint64_t FNV_OFFSET = 14695981039346656037ULL;
+
+    struct Header {
+        char magic[8];
+        int32_t n;
+        int32_t elemSize;
+        uint64_t key;
+    };
+
+    std::string dir;
+
+    static uint64_t fnv1a(uint64_t hash, const void* data, size_t len) {
+        const unsigned char* p = static_cast<const unsigned char*>(data);
+        for (size_t i = 0; i < len; ++i) {
+            hash = (hash ^ p[i]) * 1099511628211ULL;
         }
+        return hash;
     }
-    if (optind != argc - 1) {
-        std::cout << "Usage: " << argv[0] << " [-dt] <file|size>\n";
-        return EXIT_FAILURE;
+
+    std::string path(uint64_t key) const {
+        char name[32];
+        snprintf(name, sizeof(name), "lu-%016llx.bin", (unsigned long long)key);
+        return dir + "/" + name;
     }
+};
+
+// Command-line settings, applied to the solver once the precision is known
+struct Options {
+    std::string cacheDir;
+    std::string input;
+    std::string policy = "omp";
+    int nrhs = 1;
+    bool debug = false;
+    bool pivot = false;
+    bool triangular = false;
+};
+
+// Solves the system in precision T with the loop policy Policy and prints the
+// error and timings
+template <typename T, typename Policy>
+int run(const Options& opts) {
+    Solver<T, Policy> solver;
+    solver.nrhs = opts.nrhs;
+    solver.debug_mode = opts.debug;
+    solver.pivot_mode = opts.pivot;
+    solver.triangular_mode = opts.triangular;
+    const std::string& cacheDir = opts.cacheDir;
 
     START_TIMER(init)
-    std::string arg = argv[optind];
+    const std::string& arg = opts.input;
     if (arg.find_first_not_of("0123456789") == std::string::npos) {
         solver.n = std::stoi(arg);
         solver.generateRandomSystem();
     } else {
         solver.readSystemFromFile(arg);
     }
+    solver.initPermutation();
     STOP_TIMER(init)
 
     if (solver.debug_mode) {
         std::cout << "Original A = \n";
-        solver.printMatrix(solver.A, solver.n, solver.n);
+        solver.printMatrix(solver.A.data(), solver.n, solver.n, solver.lda);
         std::cout << "Original b = \n";
-        solver.printMatrix(solver.b, solver.n, 1);
+        solver.printMatrix(solver.b.data(), solver.n, solver.nrhs, solver.nrhs);
     }  
 
+    // With a cache directory, factor A once (or load the cached factors) and
+    // solve from the factors; otherwise eliminate A and b together
+    bool useCache = !cacheDir.empty() && !solver.triangular_mode;
+
     START_TIMER(gaus);
-    if (!solver.triangular_mode) {
+    if (useCache) {
+        FactorizationCache cache(cacheDir);
+        uint64_t key = FactorizationCache::hashMatrix(solver);
+        if (cache.load(solver, key)) {
+            if (solver.debug_mode) {
+                std::cout << "Loaded LU factorization from cache\n";
+            }
+        } else {
+            solver.factor();
+            cache.save(solver, key);
+        }
+    } else if (!solver.triangular_mode) {
         solver.gaussianElimination();
     }
     STOP_TIMER(gaus);
 
     START_TIMER(bsub);
-    solver.backSubstitution();
+    if (useCache) {
+        solver.solve();
+    } else if (solver.nrhs > 1) {
+        solver.backSubstitutionMulti();
+    } else {
+        solver.backSubstitution();
+    }
     STOP_TIMER(bsub);
 
     if (solver.debug_mode) {
-        std::cout << "Triangular A = \n";
-        solver.printMatrix(solver.A, solver.n, solver.n);
+        std::cout << "Factored A (L below the diagonal, U on and above) = \n";
+        solver.printPermutedMatrix(solver.A.data(), solver.n, solver.n, solver.lda);
         std::cout << "Updated b = \n";
-        solver.printMatrix(solver.b, solver.n, 1);
+        solver.printPermutedMatrix(solver.b.data(), solver.n, solver.nrhs, solver.nrhs);
         std::cout << "Solution x = \n";
-        solver.printMatrix(solver.x, solver.n, 1);
+        solver.printMatrix(solver.x.data(), solver.n, solver.nrhs, solver.nrhs);
     }
 
 
     std::cout << "Nthreads=1  ERR=" << solver.findMaxError()
               << "  INIT: " << GET_TIMER(init) << "s  GAUS: " << GET_TIMER(gaus) << "s  BSUB: " << GET_TIMER(bsub) << "s\n";
 
+    // Print per-phase hardware counters (if enabled with TIMER_COUNTERS)
+    perf_report(GET_COUNTERS(init), GET_TIMER(init), GET_COUNTERS(gaus), GET_TIMER(gaus),
+                GET_COUNTERS(bsub), GET_TIMER(bsub));
+
+    // Write the profile (if enabled with TIMER_PROFILE)
+    profile_write();
+
     return EXIT_SUCCESS;
 }
+
+// Runs in precision T with the policy chosen with -e
+template <typename T>
+int runPolicy(const Options& opts) {
+    if (opts.policy == "seq") {
+        return run<T, RajaSeqPolicy>(opts);
+    } else if (opts.policy == "simd") {
+        return run<T, RajaSimdPolicy>(opts);
+    } else if (opts.policy == "omp") {
+        return run<T, RajaOmpPolicy>(opts);
+    } else if (opts.policy == "collapse") {
+        return run<T, RajaCollapsePolicy>(opts);
+    } else if (opts.policy == "task") {
+        return run<T, RajaTaskPolicy>(opts);
+    }
+    std::cout << "Invalid policy: " << opts.policy << " (use seq, simd, omp, collapse or task)\n";
+    return EXIT_FAILURE;
+}
+
+int main(int argc, char* argv[]) {
+    Options opts;
+    std::string precision = "double";
+    const char* usage = " [-dpt] [-c <cachedir>] [-e <policy>] [-k <nrhs>] [-s float|double|long] <file|size>\n";
+    int option;
+    while ((option = getopt(argc, argv, "c:de:k:ps:t")) != -1) {
+        switch (option) {
+        case 'c':
+            opts.cacheDir = optarg;
+            break;
+        case 'd':
+            opts.debug = true;
+            break;
+        case 'e':
+            opts.policy = optarg;
+            break;
+        case 'k':
+            opts.nrhs = std::atoi(optarg);
+            if (opts.nrhs <= 0) {
+                std::cout << "Invalid number of right-hand sides: " << optarg << "\n";
+                return EXIT_FAILURE;
+            }
+            break;
+        case 'p':
+            opts.pivot = true;
+            break;
+        case 's':
+            precision = optarg;
+            break;
+        case 't':
+            opts.triangular = true;
+            break;
+        default:
+            std::cout << "Usage: " << argv[0] << usage;
+            return EXIT_FAILURE;
+        }
+    }
+    if (optind != argc - 1) {
+        std::cout << "Usage: " << argv[0] << usage;
+        return EXIT_FAILURE;
+    }
+    opts.input = argv[optind];
+
+    if (precision == "float") {
+        return runPolicy<float>(opts);
+    } else if (precision == "double") {
+        return runPolicy<double>(opts);
+    } else if (precision == "long") {
+        return runPolicy<long double>(opts);
+    }
+    std::cout << "Invalid precision: " << precision << " (use float, double or long)\n";
+    return EXIT_FAILURE;
+}
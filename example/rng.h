@@ -0,0 +1,41 @@
+/**
+ * rng.h
+ *
+ * Counter-based pseudorandom numbers for generating test systems. Each value
+ * is a pure function of (seed, row, col), so any row or tile of the matrix
+ * can be generated independently, in any order and on any number of threads,
+ * and every backend produces a bit-identical system for the same size.
+ *
+ * The counter (row, col) is offset by the seed and scrambled with the
+ * SplitMix64 finalizer, a bijection on 64-bit integers with good avalanche
+ * behavior (see https://prng.di.unimi.it/splitmix64.c).
+ *
+ * Example:
+ *
+ *      A[row*n + col] = (REAL)rand_u31(RAND_SEED, row, col) / (REAL)ULONG_MAX;
+ */
+
+#ifndef RNG_H
+#define RNG_H
+
+#include <stdint.h>
+
+// seed used for all generated systems
+#define RAND_SEED 0
+
+/*
+ * Returns a pseudorandom integer in [0, 2^31) for entry (row, col).
+ */
+#ifdef __CUDACC__
+__host__ __device__
+#endif
+static inline uint32_t rand_u31(uint64_t seed, uint32_t row, uint32_t col)
+{
+    uint64_t z = (((uint64_t)row << 32) | col) + (seed + 1) * 0x9E3779B97F4A7C15ULL;
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    z = z ^ (z >> 31);
+    return (uint32_t)(z >> 33);
+}
+
+#endif  // RNG_H
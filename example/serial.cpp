@@ -7,6 +7,7 @@
  * Compile with --std=c99
  */
 
+#include <float.h>
 #include <getopt.h>
 #include <limits.h>
 #include <math.h>
@@ -18,129 +19,441 @@
 // custom timing macros
 #include "timer.h"
 
+// vectorized row update and dot product kernels
+#include "simd.h"
+
+// binary (memory-mapped) matrix file format
+#include "matrix_io.h"
+
+// counter-based random numbers for generated systems
+#include "rng.h"
+
+// entry point for the benchmark driver (library builds)
+#include "bench.h"
+
 // uncomment this line to enable the alternative back substitution method
 /*#define USE_COLUMN_BACKSUB*/
 
 // use 64-bit IEEE arithmetic (change to "float" to use 32-bit arithmetic)
 #define REAL double
 
-// linear system: Ax = b    (A is n x n matrix; b and x are n x 1 vectors)
+// linear system: Ax = b    (A is n x n matrix; b and x are n x nrhs matrices
+// stored row-major, one column per right-hand side)
 int n;
+int nrhs = 1;
 REAL *A;
+int lda;    // leading dimension (row stride) of A, padded (see matrix_alloc.h)
 REAL *x;
 REAL *b;
 
+// mapping of A and b when the system was loaded from a binary file
+matrix_map_t mapped_system;
+
+// row permutation from partial pivoting: logical row i of A and b is stored
+// in physical row perm[i] (identity unless pivoting is enabled)
+int *perm;
+
 // enable/disable debugging output (don't enable for large matrix sizes!)
 bool debug_mode = false;
 
 // enable/disable triangular mode (to skip the Gaussian elimination phase)
 bool triangular_mode = false;
 
+// enable/disable partial pivoting
+bool pivot_mode = false;
+
+// enable/disable fused generate-and-eliminate mode (random systems only)
+bool fused_mode = false;
+
+// enable/disable mixed precision (factor in float, refine the solution in
+// double)
+bool mixed_mode = false;
+
+// single precision copy of A factored in mixed mode (rows ldf apart, same
+// row permutation), and the number of refinement steps it took
+float *Af;
+int ldf;
+int refine_iters = 0;
+
+// maximum number of iterative refinement steps per right-hand side
+#define REFINE_MAX_ITERS 10
+
+// first pivot left for Gaussian elimination (1 if the first pivot was already
+// eliminated while the system was generated)
+int first_pivot = 0;
+
+// panel width for blocked Gaussian elimination (0 = unblocked elimination)
+int block_size = 0;
+
+// tile dimensions for the trailing matrix update in blocked elimination
+#define TILE_ROWS 64
+#define TILE_COLS 256
+
+// rows per diagonal block in the multiple right-hand side back substitution
+#define BSUB_BLOCK 64
+
+// pivots per block in the elimination profile (see timer.h)
+#define PROFILE_BLOCK 64
+
+// matrix sizes with compile-time specialized elimination and back
+// substitution kernels (see fixed_select()); override with e.g.
+// -D'FIXED_SIZES(X)=X(10) X(20)', or -D'FIXED_SIZES(X)=' for none. With
+// USE_COLUMN_BACKSUB only the elimination is specialized, so that the
+// column-oriented back substitution is used for every size
+#ifndef FIXED_SIZES
+#define FIXED_SIZES(X) X(2) X(3) X(4) X(5) X(6) X(7) X(8) X(16) X(32) X(64)
+#endif
+
 /*
- * Generate a random linear system of size n.
+ * Allocates (zero-filled) space for a generated system, with A's rows padded
+ * to the leading dimension lda.
  */
-void rand_system()
+void alloc_system()
 {
-    // allocate space for matrices
-    A = (REAL*)calloc(n*n, sizeof(REAL));
-    b = (REAL*)calloc(n,   sizeof(REAL));
-    x = (REAL*)calloc(n,   sizeof(REAL));
+    lda = matrix_lda(n, sizeof(REAL));
+    A = (REAL*)matrix_alloc((size_t)n*lda*sizeof(REAL));
+    b = (REAL*)calloc(n*nrhs, sizeof(REAL));
+    x = (REAL*)calloc(n*nrhs, sizeof(REAL));
 
     // verify that memory allocation succeeded
     if (A == NULL || b == NULL || x == NULL) {
         printf("Unable to allocate memory for linear system\n");
         exit(EXIT_FAILURE);
     }
+}
+
+/*
+ * Returns entry (row, col) of the random matrix. Each entry is a function of
+ * its row and column only, so every backend generates the same system.
+ */
+REAL rand_entry(int row, int col)
+{
+    if (row == col) {
+        return n/10.0;
+    }
+    return (REAL)rand_u31(RAND_SEED, row, col) / (REAL)ULONG_MAX;
+}
 
-    // initialize pseudorandom number generator
-    // (see https://en.wikipedia.org/wiki/Linear_congruential_generator)
-    unsigned long seed = 0;
+/*
+ * Generates one row of the random system: the entries of A and right-hand
+ * sides such that column j of the solution is all (j+1)s.
+ */
+void rand_row(int row)
+{
+    int col = triangular_mode ? row : 0;
+    for (; col < n; col++) {
+        A[row*lda + col] = rand_entry(row, col);
+    }
+    REAL sum = 0.0;
+    for (int col = 0; col < n; col++) {
+        sum += A[row*lda + col] * 1.0;
+    }
+    for (int j = 0; j < nrhs; j++) {
+        b[row*nrhs + j] = sum * (j+1);
+    }
+}
 
-    // generate random matrix entries
+/*
+ * Generate a random linear system of size n.
+ */
+void rand_system()
+{
+    alloc_system();
     for (int row = 0; row < n; row++) {
-        int col = triangular_mode ? row : 0;
-        for (; col < n; col++) {
-            if (row != col) {
-                seed = (1103515245*seed + 12345) % (1<<31);
-                A[row*n + col] = (REAL)seed / (REAL)ULONG_MAX;
-            } else {
-                A[row*n + col] = n/10.0;
+        rand_row(row);
+    }
+}
+
+/*
+ * Generates the same system as rand_system() with the first pivot already
+ * eliminated: each row is updated against the pivot row right after it is
+ * generated, while it is still in cache, so the original A never has to be
+ * written out and read back. Elimination then starts at the second pivot.
+ */
+void rand_system_fused()
+{
+    alloc_system();
+
+    // with pivoting, pick the first pivot from column 0 (generated directly)
+    if (pivot_mode) {
+        int best = 0;
+        REAL best_val = fabs(rand_entry(0, 0));
+        for (int row = 1; row < n; row++) {
+            REAL val = fabs(rand_entry(row, 0));
+            if (val > best_val) {
+                best = row;
+                best_val = val;
             }
         }
+        if (best_val == 0.0) {
+            printf("Matrix is singular\n");
+            exit(EXIT_FAILURE);
+        }
+        perm[best] = perm[0];
+        perm[0] = best;
     }
 
-    // generate right-hand side such that the solution matrix is all 1s
-    for (int row = 0; row < n; row++) {
-        b[row] = 0.0;
-        for (int col = 0; col < n; col++) {
-            b[row] += A[row*n + col] * 1.0;
+    int prow = perm[0];
+    rand_row(prow);
+    for (int r = 0; r < n; r++) {
+        if (r == prow) {
+            continue;
         }
+        rand_row(r);
+        REAL coeff = A[r*lda] / A[prow*lda];
+        A[r*lda] = coeff;
+        row_update(&A[r*lda + 1], &A[prow*lda + 1], coeff, n-1);
+        row_update(&b[r*nrhs], &b[prow*nrhs], coeff, nrhs);
     }
+    first_pivot = 1;
 }
 
 /*
  * Reads a linear system of equations from a file in the form of an augmented
- * matrix [A][b].
+ * matrix [A][b] (each row holds n entries of A followed by nrhs entries of b),
+ * or maps it from a file in the binary format (see matrix_io.h).
  */
 void read_system(const char *fn)
 {
-    // open file and read matrix dimensions
-    FILE* fin = fopen(fn, "r");
-    if (fin == NULL) {
-        printf("Unable to open file \"%s\"\n", fn);
-        exit(EXIT_FAILURE);
+    // binary files are mapped and used in place
+    if (matrix_map(fn, nrhs, sizeof(REAL), &mapped_system)) {
+        n = mapped_system.n;
+        lda = n;
+        A = (REAL*)mapped_system.A;
+        b = (REAL*)mapped_system.b;
+        x = (REAL*)calloc(n*nrhs, sizeof(REAL));
+        if (x == NULL) {
+            printf("Unable to allocate memory for linear system\n");
+            exit(EXIT_FAILURE);
+        }
+        return;
     }
-    if (fscanf(fin, "%d\n", &n) != 1) {
-        printf("Invalid matrix file format\n");
+
+    // parse text file (serial version: one parser thread)
+    matrix_read_text(fn, nrhs, 1, &n, &A, &b, &lda);
+    x = (REAL*)calloc(n*nrhs, sizeof(REAL));
+    if (x == NULL) {
+        printf("Unable to allocate memory for linear system\n");
         exit(EXIT_FAILURE);
     }
+}
 
-    // allocate space for matrices
-    A = (REAL*)malloc(sizeof(REAL) * n*n);
-    b = (REAL*)malloc(sizeof(REAL) * n);
-    x = (REAL*)malloc(sizeof(REAL) * n);
-
-    // verify that memory allocation succeeded
-    if (A == NULL || b == NULL || x == NULL) {
+/*
+ * Allocates the row permutation and initializes it to the identity.
+ */
+void init_permutation()
+{
+    perm = (int*)malloc(sizeof(int) * n);
+    if (perm == NULL) {
         printf("Unable to allocate memory for linear system\n");
         exit(EXIT_FAILURE);
     }
-
-    // read all values
     for (int row = 0; row < n; row++) {
-        for (int col = 0; col < n; col++) {
-            if (fscanf(fin, "%lf", &A[row*n + col]) != 1) {
-                printf("Invalid matrix file format\n");
-                exit(EXIT_FAILURE);
-            }
-        }
-        if (fscanf(fin, "%lf", &b[row]) != 1) {
-            printf("Invalid matrix file format\n");
-            exit(EXIT_FAILURE);
+        perm[row] = row;
+    }
+}
+
+/*
+ * Partial pivoting: finds the row at or below the pivot with the largest
+ * magnitude in the pivot column and moves it into the pivot position. Rows
+ * are swapped in the permutation only; A and b are never copied.
+ */
+void select_pivot(int pivot)
+{
+    int best = pivot;
+    REAL best_val = fabs(A[perm[pivot]*lda + pivot]);
+    for (int row = pivot+1; row < n; row++) {
+        REAL val = fabs(A[perm[row]*lda + pivot]);
+        if (val > best_val) {
+            best = row;
+            best_val = val;
         }
-        x[row] = 0.0;     // initialize x while we're reading A and b
     }
-    fclose(fin);
+    if (best_val == 0.0) {
+        printf("Matrix is singular\n");
+        exit(EXIT_FAILURE);
+    }
+    int tmp = perm[pivot];
+    perm[pivot] = perm[best];
+    perm[best] = tmp;
 }
 
 /*
- * Performs Gaussian elimination on the linear system.
- * Assumes the matrix is singular and doesn't require any pivoting.
+ * Performs Gaussian elimination on the linear system, leaving the multipliers
+ * below the diagonal so that A holds its L and U factors afterwards.
+ * Without pivot_mode, assumes the matrix doesn't require any pivoting.
+ * Starts at first_pivot (earlier pivots were eliminated during generation).
  */
 void gaussian_elimination()
 {
-    for (int pivot = 0; pivot < n; pivot++) {
+    for (int pivot = first_pivot; pivot < n; pivot++) {
+        int blk = pivot / PROFILE_BLOCK;
+        if (pivot_mode) {
+            PROFILE_SCOPE_BLOCK("pivot_search", blk);
+            select_pivot(pivot);
+        }
+        PROFILE_SCOPE_BLOCK("update", blk);
+        int prow = perm[pivot];
         for (int row = pivot+1; row < n; row++) {
-            REAL coeff = A[row*n + pivot] / A[pivot*n + pivot];
-            A[row*n + pivot] = 0.0;
-            for (int col = pivot+1; col < n; col++) {
-                A[row*n + col] -= A[pivot*n + col] * coeff;
+            int r = perm[row];
+            REAL coeff = A[r*lda + pivot] / A[prow*lda + pivot];
+            A[r*lda + pivot] = coeff;     // keep the multiplier (L below the diagonal)
+            row_update(&A[r*lda + pivot+1], &A[prow*lda + pivot+1], coeff, n-pivot-1);
+            row_update(&b[r*nrhs], &b[prow*nrhs], coeff, nrhs);
+        }
+    }
+}
+
+/*
+ * Applies the pivots in columns k0..k1-1 to a tile of the trailing matrix
+ * (rows r0..r1-1, columns c0..c1-1). Expects the multipliers for the tile's
+ * rows to be stored in the panel columns and the pivot rows to be final.
+ *
+ * The main loop keeps a 4x4 block of the tile in registers for the whole
+ * panel; the updates are still applied one pivot at a time.
+ */
+void update_tile(int r0, int r1, int c0, int c1, int k0, int k1)
+{
+    int row = r0;
+    for (; row + 4 <= r1; row += 4) {
+        REAL *a[4];
+        for (int i = 0; i < 4; i++) {
+            a[i] = &A[perm[row+i]*lda];
+        }
+        int col = c0;
+        for (; col + 4 <= c1; col += 4) {
+            REAL acc[4][4];
+            for (int i = 0; i < 4; i++) {
+                for (int j = 0; j < 4; j++) {
+                    acc[i][j] = a[i][col+j];
+                }
+            }
+            for (int pivot = k0; pivot < k1; pivot++) {
+                REAL *p = &A[perm[pivot]*lda];
+                for (int i = 0; i < 4; i++) {
+                    REAL coeff = a[i][pivot];
+                    for (int j = 0; j < 4; j++) {
+                        acc[i][j] -= p[col+j] * coeff;
+                    }
+                }
+            }
+            for (int i = 0; i < 4; i++) {
+                for (int j = 0; j < 4; j++) {
+                    a[i][col+j] = acc[i][j];
+                }
+            }
+        }
+        for (int i = 0; i < 4; i++) {
+            for (int pivot = k0; pivot < k1; pivot++) {
+                REAL *p = &A[perm[pivot]*lda];
+                REAL coeff = a[i][pivot];
+                for (int j = col; j < c1; j++) {
+                    a[i][j] -= p[j] * coeff;
+                }
+            }
+        }
+    }
+    for (; row < r1; row++) {
+        int r = perm[row];
+        for (int pivot = k0; pivot < k1; pivot++) {
+            int prow = perm[pivot];
+            REAL coeff = A[r*lda + pivot];
+            for (int col = c0; col < c1; col++) {
+                A[r*lda + col] -= A[prow*lda + col] * coeff;
             }
-            b[row] -= b[pivot] * coeff;
         }
     }
 }
 
+/*
+ * Performs Gaussian elimination on the linear system using a cache-blocked
+ * right-looking algorithm: each panel of block_size columns is factored and
+ * then applied to the trailing matrix one cache-sized tile at a time, so A is
+ * streamed through memory once per panel instead of once per pivot.
+ *
+ * Every entry receives the same updates in the same order as in
+ * gaussian_elimination(), so both produce identical results (including the
+ * multipliers left below the diagonal).
+ */
+void gaussian_elimination_blocked()
+{
+    // panels end on multiples of block_size (the first one is shorter when
+    // the first pivot was eliminated during generation)
+    for (int k0 = first_pivot; k0 < n; ) {
+        int k1 = (k0 / block_size + 1) * block_size;
+        k1 = (k1 < n) ? k1 : n;
+        int blk = k0 / block_size;
+
+        profile_begin("panel", blk);
+        if (pivot_mode) {
+            // the pivot search needs the whole column, so factor the panel
+            // one pivot at a time (multipliers are kept in place)
+            for (int pivot = k0; pivot < k1; pivot++) {
+                select_pivot(pivot);
+                int prow = perm[pivot];
+                for (int row = pivot+1; row < n; row++) {
+                    int r = perm[row];
+                    REAL coeff = A[r*lda + pivot] / A[prow*lda + pivot];
+                    A[r*lda + pivot] = coeff;
+                    row_update(&A[r*lda + pivot+1], &A[prow*lda + pivot+1], coeff, k1-pivot-1);
+                    row_update(&b[r*nrhs], &b[prow*nrhs], coeff, nrhs);
+                }
+            }
+        } else {
+            // factor the diagonal block
+            for (int pivot = k0; pivot < k1; pivot++) {
+                for (int row = pivot+1; row < k1; row++) {
+                    REAL coeff = A[row*lda + pivot] / A[pivot*lda + pivot];
+                    A[row*lda + pivot] = coeff;
+                    row_update(&A[row*lda + pivot+1], &A[pivot*lda + pivot+1], coeff, k1-pivot-1);
+                    row_update(&b[row*nrhs], &b[pivot*nrhs], coeff, nrhs);
+                }
+            }
+
+            // factor the rest of the panel (multipliers are kept in place)
+            for (int row = k1; row < n; row++) {
+                for (int pivot = k0; pivot < k1; pivot++) {
+                    REAL coeff = A[row*lda + pivot] / A[pivot*lda + pivot];
+                    A[row*lda + pivot] = coeff;
+                    row_update(&A[row*lda + pivot+1], &A[pivot*lda + pivot+1], coeff, k1-pivot-1);
+                    row_update(&b[row*nrhs], &b[pivot*nrhs], coeff, nrhs);
+                }
+            }
+        }
+
+        profile_end();
+
+        // update the block row to the right of the diagonal block
+        profile_begin("block_row", blk);
+        for (int c0 = k1; c0 < n; c0 += TILE_COLS) {
+            int c1 = (c0 + TILE_COLS < n) ? c0 + TILE_COLS : n;
+            for (int pivot = k0; pivot < k1; pivot++) {
+                int prow = perm[pivot];
+                for (int row = pivot+1; row < k1; row++) {
+                    int r = perm[row];
+                    REAL coeff = A[r*lda + pivot];
+                    row_update(&A[r*lda + c0], &A[prow*lda + c0], coeff, c1-c0);
+                }
+            }
+        }
+
+        profile_end();
+
+        // update the trailing matrix
+        profile_begin("trailing", blk);
+        for (int r0 = k1; r0 < n; r0 += TILE_ROWS) {
+            int r1 = (r0 + TILE_ROWS < n) ? r0 + TILE_ROWS : n;
+            for (int c0 = k1; c0 < n; c0 += TILE_COLS) {
+                int c1 = (c0 + TILE_COLS < n) ? c0 + TILE_COLS : n;
+                update_tile(r0, r1, c0, c1, k0, k1);
+            }
+        }
+        profile_end();
+
+        k0 = k1;
+    }
+}
+
 /*
  * Performs backwards substitution on the linear system.
  * (row-oriented version)
@@ -149,11 +462,9 @@ void back_substitution_row()
 {
     REAL tmp;
     for (int row = n-1; row >= 0; row--) {
-        tmp = b[row];
-        for (int col = row+1; col < n; col++) {
-            tmp += -A[row*n + col] * x[col];
-        }
-        x[row] = tmp / A[row*n + row];
+        int r = perm[row];
+        tmp = b[r] - dot(&A[r*lda + row+1], &x[row+1], n-row-1);
+        x[row] = tmp / A[r*lda + row];
     }
 }
 
@@ -164,16 +475,272 @@ void back_substitution_row()
 void back_substitution_column()
 {
     for (int row = 0; row < n; row++) {
-        x[row] = b[row];
+        x[row] = b[perm[row]];
     }
     for (int col = n-1; col >= 0; col--) {
-        x[col] /= A[col*n + col];
+        x[col] /= A[perm[col]*lda + col];
         for (int row = 0; row < col; row++) {
-            x[row] += -A[row*n + col] * x[col];
+            x[row] += -A[perm[row]*lda + col] * x[col];
+        }
+    }
+}
+
+/*
+ * Performs backwards substitution for all nrhs right-hand sides at once, as a
+ * blocked triangular solve. For each block of BSUB_BLOCK rows (bottom to top),
+ * the already solved rows below the block are applied with row updates that
+ * run across all right-hand sides, then the small diagonal block is solved.
+ */
+void back_substitution_multi()
+{
+    for (int i1 = n; i1 > 0; i1 -= BSUB_BLOCK) {
+        int i0 = (i1 - BSUB_BLOCK > 0) ? i1 - BSUB_BLOCK : 0;
+
+        // apply the solved rows below the block
+        for (int row = i0; row < i1; row++) {
+            int r = perm[row];
+            for (int j = 0; j < nrhs; j++) {
+                x[row*nrhs + j] = b[r*nrhs + j];
+            }
+            for (int col = i1; col < n; col++) {
+                row_update(&x[row*nrhs], &x[col*nrhs], A[r*lda + col], nrhs);
+            }
+        }
+
+        // solve the diagonal block
+        for (int row = i1-1; row >= i0; row--) {
+            int r = perm[row];
+            for (int col = row+1; col < i1; col++) {
+                row_update(&x[row*nrhs], &x[col*nrhs], A[r*lda + col], nrhs);
+            }
+            for (int j = 0; j < nrhs; j++) {
+                x[row*nrhs + j] /= A[r*lda + row];
+            }
         }
     }
 }
 
+/*
+ * Gaussian elimination for an N x N system (N == n). Same algorithm as
+ * gaussian_elimination(), but every trip count is known at compile time, so
+ * the row updates are plain loops the compiler can fully unroll and
+ * vectorize instead of calls to the run-time dispatched row_update(). Like
+ * simd.h, the widest instruction set the CPU supports is picked at startup
+ * (target_clones), and the results are identical to gaussian_elimination().
+ */
+template <int N>
+__attribute__((target_clones("avx512f", "avx2", "default")))
+void gaussian_elimination_fixed()
+{
+    for (int pivot = first_pivot; pivot < N; pivot++) {
+        if (pivot_mode) {
+            select_pivot(pivot);
+        }
+        REAL *p = &A[perm[pivot]*lda];
+        REAL *pb = &b[perm[pivot]*nrhs];
+        for (int row = pivot+1; row < N; row++) {
+            REAL *a = &A[perm[row]*lda];
+            REAL *ab = &b[perm[row]*nrhs];
+            REAL coeff = a[pivot] / p[pivot];
+            a[pivot] = coeff;
+            for (int col = pivot+1; col < N; col++) {
+                a[col] -= p[col] * coeff;
+            }
+            for (int j = 0; j < nrhs; j++) {
+                ab[j] -= pb[j] * coeff;
+            }
+        }
+    }
+}
+
+/*
+ * Backwards substitution for an N x N system (N == n) and all nrhs
+ * right-hand sides (row-oriented). The system is small enough that the
+ * blocking in back_substitution_multi() doesn't pay off.
+ */
+template <int N>
+__attribute__((target_clones("avx512f", "avx2", "default")))
+void back_substitution_fixed()
+{
+    for (int row = N-1; row >= 0; row--) {
+        REAL *a = &A[perm[row]*lda];
+        REAL *xr = &x[row*nrhs];
+        for (int j = 0; j < nrhs; j++) {
+            xr[j] = b[perm[row]*nrhs + j];
+        }
+        for (int col = row+1; col < N; col++) {
+            for (int j = 0; j < nrhs; j++) {
+                xr[j] -= x[col*nrhs + j] * a[col];
+            }
+        }
+        for (int j = 0; j < nrhs; j++) {
+            xr[j] /= a[row];
+        }
+    }
+}
+
+// elimination and back substitution kernels for one matrix size
+typedef struct {
+    void (*eliminate)();
+    void (*back_substitution)();
+} fixed_kernels_t;
+
+/*
+ * Returns the kernels specialized for size n (one of FIXED_SIZES), or NULL
+ * kernels if there are none, in which case the generic code is used. The
+ * back substitution kernel is row-oriented, so it is left out (NULL) when
+ * USE_COLUMN_BACKSUB is defined.
+ */
+fixed_kernels_t fixed_select(int n)
+{
+    fixed_kernels_t k = { NULL, NULL };
+    switch (n) {
+#   define FIXED_CASE(N) \
+    case N: \
+        k.eliminate = gaussian_elimination_fixed<N>; \
+        k.back_substitution = back_substitution_fixed<N>; \
+        break;
+    FIXED_SIZES(FIXED_CASE)
+#   undef FIXED_CASE
+    default:
+        break;
+    }
+#   ifdef USE_COLUMN_BACKSUB
+    k.back_substitution = NULL;
+#   endif
+    return k;
+}
+
+/*
+ * Mixed precision: copies A into Af (single precision) and factors it there,
+ * leaving the float multipliers below the diagonal. A itself is kept in
+ * double precision for the residuals in solve_mixed(). b is not touched.
+ */
+void factor_mixed()
+{
+    ldf = matrix_lda(n, sizeof(float));
+    Af = (float*)matrix_alloc((size_t)n*ldf*sizeof(float));
+    if (Af == NULL) {
+        printf("Unable to allocate memory for linear system\n");
+        exit(EXIT_FAILURE);
+    }
+    for (int row = 0; row < n; row++) {
+        for (int col = 0; col < n; col++) {
+            Af[row*ldf + col] = (float)A[row*lda + col];
+        }
+    }
+
+    for (int pivot = 0; pivot < n; pivot++) {
+        int blk = pivot / PROFILE_BLOCK;
+        if (pivot_mode) {
+            PROFILE_SCOPE_BLOCK("pivot_search", blk);
+            int best = pivot;
+            float best_val = fabsf(Af[perm[pivot]*ldf + pivot]);
+            for (int row = pivot+1; row < n; row++) {
+                float val = fabsf(Af[perm[row]*ldf + pivot]);
+                if (val > best_val) {
+                    best = row;
+                    best_val = val;
+                }
+            }
+            if (best_val == 0.0f) {
+                printf("Matrix is singular\n");
+                exit(EXIT_FAILURE);
+            }
+            int tmp = perm[pivot];
+            perm[pivot] = perm[best];
+            perm[best] = tmp;
+        }
+        PROFILE_SCOPE_BLOCK("update", blk);
+        int prow = perm[pivot];
+        for (int row = pivot+1; row < n; row++) {
+            int r = perm[row];
+            float coeff = Af[r*ldf + pivot] / Af[prow*ldf + pivot];
+            Af[r*ldf + pivot] = coeff;
+            row_update(&Af[r*ldf + pivot+1], &Af[prow*ldf + pivot+1], coeff, n-pivot-1);
+        }
+    }
+}
+
+/*
+ * Solves LU d = r with the single precision factors in Af (forward
+ * substitution with L on the permuted r, then back substitution with U).
+ * r is indexed by physical row like b; d (and w, n floats of scratch) by
+ * logical row like x.
+ */
+void lu_solve_float(const REAL *r, REAL *d, float *w)
+{
+    for (int row = 0; row < n; row++) {
+        int pr = perm[row];
+        w[row] = (float)r[pr] - dot(&Af[pr*ldf], w, row);
+    }
+    for (int row = n-1; row >= 0; row--) {
+        int pr = perm[row];
+        w[row] = (w[row] - dot(&Af[pr*ldf + row+1], &w[row+1], n-row-1)) / Af[pr*ldf + row];
+    }
+    for (int row = 0; row < n; row++) {
+        d[row] = w[row];
+    }
+}
+
+/*
+ * Mixed precision: solves for each right-hand side with the float factors,
+ * then refines the solution: computes the residual r = b - Ax in double
+ * precision against the original A, solves LU d = r in single precision and
+ * adds the correction, until the correction no longer changes x (or stops
+ * shrinking, or after REFINE_MAX_ITERS steps).
+ */
+void solve_mixed()
+{
+    REAL *xc = (REAL*)malloc(n * sizeof(REAL));
+    REAL *r = (REAL*)malloc(n * sizeof(REAL));
+    REAL *d = (REAL*)malloc(n * sizeof(REAL));
+    float *w = (float*)malloc(n * sizeof(float));
+    if (xc == NULL || r == NULL || d == NULL || w == NULL) {
+        printf("Unable to allocate memory for linear system\n");
+        exit(EXIT_FAILURE);
+    }
+
+    refine_iters = 0;
+    for (int j = 0; j < nrhs; j++) {
+        for (int row = 0; row < n; row++) {
+            r[row] = b[row*nrhs + j];
+        }
+        lu_solve_float(r, xc, w);
+
+        REAL prev = INFINITY;
+        for (int iter = 0; iter < REFINE_MAX_ITERS; iter++) {
+            PROFILE_SCOPE("refine");
+            for (int row = 0; row < n; row++) {
+                r[row] = b[row*nrhs + j] - dot(&A[row*lda], xc, n);
+            }
+            lu_solve_float(r, d, w);
+            REAL dnorm = 0.0, xnorm = 0.0;
+            for (int row = 0; row < n; row++) {
+                xc[row] += d[row];
+                dnorm = fmax(dnorm, fabs(d[row]));
+                xnorm = fmax(xnorm, fabs(xc[row]));
+            }
+            if (iter + 1 > refine_iters) {
+                refine_iters = iter + 1;
+            }
+            if (dnorm <= DBL_EPSILON * xnorm || dnorm >= prev) {
+                break;
+            }
+            prev = dnorm;
+        }
+
+        for (int row = 0; row < n; row++) {
+            x[row*nrhs + j] = xc[row];
+        }
+    }
+
+    free(xc);
+    free(r);
+    free(d);
+    free(w);
+}
+
 /*
  * Find the maximum error in the solution (only works for randomly-generated
  * matrices).
@@ -182,9 +749,11 @@ REAL find_max_error()
 {
     REAL error = 0.0, tmp;
     for (int row = 0; row < n; row++) {
-        tmp = fabs(x[row] - 1.0);
-        if (tmp > error) {
-            error = tmp;
+        for (int j = 0; j < nrhs; j++) {
+            tmp = fabs(x[row*nrhs + j] - (j+1));
+            if (tmp > error) {
+                error = tmp;
+            }
         }
     }
     return error;
@@ -203,25 +772,77 @@ void print_matrix(REAL *mat, int rows, int cols)
     }
 }
 
-int main(int argc, char *argv[])
+/*
+ * Prints a matrix stored with the row permutation in logical row order.
+ */
+void print_permuted_matrix(REAL *mat, int rows, int cols, int ld)
+{
+    for (int row = 0; row < rows; row++) {
+        for (int col = 0; col < cols; col++) {
+            printf("%8.1e ", mat[perm[row]*ld + col]);
+        }
+        printf("\n");
+    }
+}
+
+/*
+ * Runs the program with the given command line. If result is not NULL (when
+ * called by the benchmark driver), the error and phase times are stored there
+ * instead of being printed.
+ */
+int run(int argc, char *argv[], bench_result_t *result)
 {
+    // reset the options, since the benchmark driver calls run() repeatedly
+    optind = 1;
+    nrhs = 1;
+    block_size = 0;
+    debug_mode = triangular_mode = pivot_mode = fused_mode = mixed_mode = false;
+    first_pivot = 0;
+
     // check and parse command line options
     int c;
-    while ((c = getopt(argc, argv, "dt")) != -1) {
+    while ((c = getopt(argc, argv, "b:dfk:mpt")) != -1) {
         switch (c) {
+        case 'b':
+            block_size = (int)strtol(optarg, NULL, 10);
+            if (block_size <= 0) {
+                printf("Invalid panel width: %s\n", optarg);
+                exit(EXIT_FAILURE);
+            }
+            break;
         case 'd':
             debug_mode = true;
             break;
+        case 'f':
+            fused_mode = true;
+            break;
+        case 'k':
+            nrhs = (int)strtol(optarg, NULL, 10);
+            if (nrhs <= 0) {
+                printf("Invalid number of right-hand sides: %s\n", optarg);
+                exit(EXIT_FAILURE);
+            }
+            break;
+        case 'm':
+            mixed_mode = true;
+            break;
+        case 'p':
+            pivot_mode = true;
+            break;
         case 't':
             triangular_mode = true;
             break;
         default:
-            printf("Usage: %s [-dt] <file|size>\n", argv[0]);
+            printf("Usage: %s [-dfmpt] [-b <panel>] [-k <nrhs>] <file|size>\n", argv[0]);
             exit(EXIT_FAILURE);
         }
     }
     if (optind != argc-1) {
-        printf("Usage: %s [-dt] <file|size>\n", argv[0]);
+        printf("Usage: %s [-dfmpt] [-b <panel>] [-k <nrhs>] <file|size>\n", argv[0]);
+        exit(EXIT_FAILURE);
+    }
+    if (mixed_mode && (block_size > 0 || fused_mode || triangular_mode)) {
+        printf("Mixed precision (-m) can't be combined with -b, -f or -t\n");
         exit(EXIT_FAILURE);
     }
 
@@ -230,52 +851,118 @@ int main(int argc, char *argv[])
     START_TIMER(init)
     if (size == 0) {
         read_system(argv[optind]);
+        init_permutation();
     } else {
         n = (int)size;
-        rand_system();
+        init_permutation();
+        if (fused_mode && !triangular_mode) {
+            rand_system_fused();
+        } else {
+            rand_system();
+        }
     }
     STOP_TIMER(init)
 
     if (debug_mode) {
-        printf("Original A = \n");
-        print_matrix(A, n, n);
-        printf("Original b = \n");
-        print_matrix(b, n, 1);
+        printf(first_pivot ? "A after the first pivot = \n" : "Original A = \n");
+        print_permuted_matrix(A, n, n, lda);
+        printf(first_pivot ? "b after the first pivot = \n" : "Original b = \n");
+        print_permuted_matrix(b, n, nrhs, nrhs);
     }
 
+    // use the kernels specialized for this size, if there are any
+    fixed_kernels_t fixed = fixed_select(n);
+
     // perform gaussian elimination
     START_TIMER(gaus)
-    if (!triangular_mode) {
-        gaussian_elimination();
+    if (mixed_mode) {
+        factor_mixed();
+    } else if (!triangular_mode) {
+        if (block_size > 0) {
+            gaussian_elimination_blocked();
+        } else if (fixed.eliminate != NULL) {
+            fixed.eliminate();
+        } else {
+            gaussian_elimination();
+        }
     }
     STOP_TIMER(gaus)
 
     // perform backwards substitution
     START_TIMER(bsub)
-#   ifndef USE_COLUMN_BACKSUB
-    back_substitution_row();
-#   else
-    back_substitution_column();
-#   endif
+    if (mixed_mode) {
+        solve_mixed();
+    } else if (fixed.back_substitution != NULL) {
+        fixed.back_substitution();
+    } else if (nrhs > 1) {
+        back_substitution_multi();
+    } else {
+#       ifndef USE_COLUMN_BACKSUB
+        back_substitution_row();
+#       else
+        back_substitution_column();
+#       endif
+    }
     STOP_TIMER(bsub)
 
-    if (debug_mode) {
-        printf("Triangular A = \n");
-        print_matrix(A, n, n);
+    if (debug_mode && !mixed_mode) {
+        printf("Factored A (L below the diagonal, U on and above) = \n");
+        print_permuted_matrix(A, n, n, lda);
         printf("Updated b = \n");
-        print_matrix(b, n, 1);
+        print_permuted_matrix(b, n, nrhs, nrhs);
+    }
+    if (debug_mode) {
         printf("Solution x = \n");
-        print_matrix(x, n, 1);
+        print_matrix(x, n, nrhs);
+    }
+
+    // print results (or return them to the benchmark driver)
+    if (result != NULL) {
+        result->threads = 1;
+        result->err = find_max_error();
+        result->init = GET_TIMER(init);
+        result->gaus = GET_TIMER(gaus);
+        result->bsub = GET_TIMER(bsub);
+    } else {
+        printf("Nthreads=%2d  ERR=%8.1e  INIT: %8.4fs  GAUS: %8.4fs  BSUB: %8.4fs\n",
+                1, find_max_error(),
+                GET_TIMER(init), GET_TIMER(gaus), GET_TIMER(bsub));
+
+        // print per-phase hardware counters (if enabled with TIMER_COUNTERS)
+        perf_report(GET_COUNTERS(init), GET_TIMER(init), GET_COUNTERS(gaus), GET_TIMER(gaus),
+                GET_COUNTERS(bsub), GET_TIMER(bsub));
+
+        if (mixed_mode) {
+            printf("MIXED: factored in single precision, %d refinement steps\n", refine_iters);
+        }
     }
 
-    // print results
-    printf("Nthreads=%2d  ERR=%8.1e  INIT: %8.4fs  GAUS: %8.4fs  BSUB: %8.4fs\n",
-            1, find_max_error(),
-            GET_TIMER(init), GET_TIMER(gaus), GET_TIMER(bsub));
+    // write the profile (if enabled with TIMER_PROFILE)
+    profile_write();
 
     // clean up and exit
-    free(A);
-    free(b);
+    if (mapped_system.base != NULL) {
+        matrix_unmap(&mapped_system);
+    } else {
+        matrix_free(A);
+        free(b);
+    }
+    if (mixed_mode) {
+        matrix_free(Af);
+    }
     free(x);
+    free(perm);
     return EXIT_SUCCESS;
 }
+
+#ifdef LIBRARY_BUILD
+BENCH_EXPORT int bench_run(int argc, char *argv[], bench_result_t *result)
+{
+    return run(argc, argv, result);
+}
+#else
+int main(int argc, char *argv[])
+{
+    return run(argc, argv, NULL);
+}
+#endif
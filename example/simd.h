@@ -0,0 +1,294 @@
+/**
+ * simd.h
+ *
+ * Explicitly vectorized kernels for the inner loops of the solvers, in float
+ * and double versions (long double versions are scalar). The widest
+ * implementation the CPU supports (AVX-512, AVX2 or plain scalar code) is
+ * picked at startup through CPUID, so the same binary runs at full width on
+ * every node. Non-x86 builds use the scalar versions. Setting SIMD_ISA=avx2
+ * or SIMD_ISA=scalar in the environment caps the selection (e.g. to compare
+ * instruction sets on the same node).
+ *
+ *      row_update(dst, src, coeff, len)     dst[i] -= src[i] * coeff
+ *      dot(a, b, len)                       returns sum of a[i] * b[i]
+ *
+ * row_update() multiplies and subtracts separately (FMA contraction is
+ * disabled for it) so elimination produces bit-identical results whichever
+ * version is selected.
+ *
+ * Example:
+ *
+ *      row_update(&A[row*n + pivot+1], &A[pivot*n + pivot+1], coeff, n-pivot-1);
+ *      tmp = b[row] - dot(&A[row*n + row+1], &x[row+1], n-row-1);
+ */
+
+#ifndef SIMD_H
+#define SIMD_H
+
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#   include <immintrin.h>
+#   define SIMD_X86
+#endif
+
+/*
+ * Scalar versions (also used for the tails of the vector loops).
+ */
+template <typename T>
+static void row_update_scalar(T *__restrict dst, const T *__restrict src,
+        T coeff, int len)
+{
+    for (int i = 0; i < len; i++) {
+        dst[i] -= src[i] * coeff;
+    }
+}
+
+template <typename T>
+static T dot_scalar(const T *__restrict a, const T *__restrict b, int len)
+{
+    T sum = 0.0;
+    for (int i = 0; i < len; i++) {
+        sum += a[i] * b[i];
+    }
+    return sum;
+}
+
+#ifdef SIMD_X86
+
+/*
+ * AVX2 versions (4 doubles or 8 floats per vector).
+ */
+__attribute__((target("avx2"), optimize("fp-contract=off")))
+static void row_update_avx2(double *__restrict dst, const double *__restrict src,
+        double coeff, int len)
+{
+    __m256d c = _mm256_set1_pd(coeff);
+    int i = 0;
+    for (; i + 8 <= len; i += 8) {
+        __m256d d0 = _mm256_loadu_pd(dst + i);
+        __m256d d1 = _mm256_loadu_pd(dst + i + 4);
+        d0 = _mm256_sub_pd(d0, _mm256_mul_pd(_mm256_loadu_pd(src + i), c));
+        d1 = _mm256_sub_pd(d1, _mm256_mul_pd(_mm256_loadu_pd(src + i + 4), c));
+        _mm256_storeu_pd(dst + i, d0);
+        _mm256_storeu_pd(dst + i + 4, d1);
+    }
+    row_update_scalar(dst + i, src + i, coeff, len - i);
+}
+
+__attribute__((target("avx2"), optimize("fp-contract=off")))
+static void row_update_avx2(float *__restrict dst, const float *__restrict src,
+        float coeff, int len)
+{
+    __m256 c = _mm256_set1_ps(coeff);
+    int i = 0;
+    for (; i + 16 <= len; i += 16) {
+        __m256 d0 = _mm256_loadu_ps(dst + i);
+        __m256 d1 = _mm256_loadu_ps(dst + i + 8);
+        d0 = _mm256_sub_ps(d0, _mm256_mul_ps(_mm256_loadu_ps(src + i), c));
+        d1 = _mm256_sub_ps(d1, _mm256_mul_ps(_mm256_loadu_ps(src + i + 8), c));
+        _mm256_storeu_ps(dst + i, d0);
+        _mm256_storeu_ps(dst + i + 8, d1);
+    }
+    row_update_scalar(dst + i, src + i, coeff, len - i);
+}
+
+__attribute__((target("avx2,fma")))
+static double dot_avx2(const double *__restrict a, const double *__restrict b, int len)
+{
+    __m256d s0 = _mm256_setzero_pd();
+    __m256d s1 = _mm256_setzero_pd();
+    int i = 0;
+    for (; i + 8 <= len; i += 8) {
+        s0 = _mm256_fmadd_pd(_mm256_loadu_pd(a + i), _mm256_loadu_pd(b + i), s0);
+        s1 = _mm256_fmadd_pd(_mm256_loadu_pd(a + i + 4), _mm256_loadu_pd(b + i + 4), s1);
+    }
+    __m256d s = _mm256_add_pd(s0, s1);
+    __m128d h = _mm_add_pd(_mm256_castpd256_pd128(s), _mm256_extractf128_pd(s, 1));
+    h = _mm_add_sd(h, _mm_unpackhi_pd(h, h));
+    return _mm_cvtsd_f64(h) + dot_scalar(a + i, b + i, len - i);
+}
+
+__attribute__((target("avx2,fma")))
+static float dot_avx2(const float *__restrict a, const float *__restrict b, int len)
+{
+    __m256 s0 = _mm256_setzero_ps();
+    __m256 s1 = _mm256_setzero_ps();
+    int i = 0;
+    for (; i + 16 <= len; i += 16) {
+        s0 = _mm256_fmadd_ps(_mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i), s0);
+        s1 = _mm256_fmadd_ps(_mm256_loadu_ps(a + i + 8), _mm256_loadu_ps(b + i + 8), s1);
+    }
+    __m256 s = _mm256_add_ps(s0, s1);
+    __m128 h = _mm_add_ps(_mm256_castps256_ps128(s), _mm256_extractf128_ps(s, 1));
+    h = _mm_add_ps(h, _mm_movehl_ps(h, h));
+    h = _mm_add_ss(h, _mm_shuffle_ps(h, h, 1));
+    return _mm_cvtss_f32(h) + dot_scalar(a + i, b + i, len - i);
+}
+
+/*
+ * AVX-512 versions (8 doubles or 16 floats per vector; the tail is handled
+ * with a masked load/store instead of a scalar loop).
+ */
+__attribute__((target("avx512f"), optimize("fp-contract=off")))
+static void row_update_avx512(double *__restrict dst, const double *__restrict src,
+        double coeff, int len)
+{
+    __m512d c = _mm512_set1_pd(coeff);
+    int i = 0;
+    for (; i + 8 <= len; i += 8) {
+        __m512d d = _mm512_loadu_pd(dst + i);
+        d = _mm512_sub_pd(d, _mm512_mul_pd(_mm512_loadu_pd(src + i), c));
+        _mm512_storeu_pd(dst + i, d);
+    }
+    if (i < len) {
+        __mmask8 m = (__mmask8)((1u << (len - i)) - 1);
+        __m512d d = _mm512_maskz_loadu_pd(m, dst + i);
+        d = _mm512_sub_pd(d, _mm512_mul_pd(_mm512_maskz_loadu_pd(m, src + i), c));
+        _mm512_mask_storeu_pd(dst + i, m, d);
+    }
+}
+
+__attribute__((target("avx512f"), optimize("fp-contract=off")))
+static void row_update_avx512(float *__restrict dst, const float *__restrict src,
+        float coeff, int len)
+{
+    __m512 c = _mm512_set1_ps(coeff);
+    int i = 0;
+    for (; i + 16 <= len; i += 16) {
+        __m512 d = _mm512_loadu_ps(dst + i);
+        d = _mm512_sub_ps(d, _mm512_mul_ps(_mm512_loadu_ps(src + i), c));
+        _mm512_storeu_ps(dst + i, d);
+    }
+    if (i < len) {
+        __mmask16 m = (__mmask16)((1u << (len - i)) - 1);
+        __m512 d = _mm512_maskz_loadu_ps(m, dst + i);
+        d = _mm512_sub_ps(d, _mm512_mul_ps(_mm512_maskz_loadu_ps(m, src + i), c));
+        _mm512_mask_storeu_ps(dst + i, m, d);
+    }
+}
+
+__attribute__((target("avx512f")))
+static double dot_avx512(const double *__restrict a, const double *__restrict b, int len)
+{
+    __m512d s0 = _mm512_setzero_pd();
+    __m512d s1 = _mm512_setzero_pd();
+    int i = 0;
+    for (; i + 16 <= len; i += 16) {
+        s0 = _mm512_fmadd_pd(_mm512_loadu_pd(a + i), _mm512_loadu_pd(b + i), s0);
+        s1 = _mm512_fmadd_pd(_mm512_loadu_pd(a + i + 8), _mm512_loadu_pd(b + i + 8), s1);
+    }
+    for (; i < len; i += 8) {
+        __mmask8 m = (len - i >= 8) ? (__mmask8)0xff : (__mmask8)((1u << (len - i)) - 1);
+        s0 = _mm512_fmadd_pd(_mm512_maskz_loadu_pd(m, a + i), _mm512_maskz_loadu_pd(m, b + i), s0);
+    }
+    double part[8];
+    _mm512_storeu_pd(part, _mm512_add_pd(s0, s1));
+    return ((part[0] + part[1]) + (part[2] + part[3])) +
+           ((part[4] + part[5]) + (part[6] + part[7]));
+}
+
+__attribute__((target("avx512f")))
+static float dot_avx512(const float *__restrict a, const float *__restrict b, int len)
+{
+    __m512 s0 = _mm512_setzero_ps();
+    __m512 s1 = _mm512_setzero_ps();
+    int i = 0;
+    for (; i + 32 <= len; i += 32) {
+        s0 = _mm512_fmadd_ps(_mm512_loadu_ps(a + i), _mm512_loadu_ps(b + i), s0);
+        s1 = _mm512_fmadd_ps(_mm512_loadu_ps(a + i + 16), _mm512_loadu_ps(b + i + 16), s1);
+    }
+    for (; i < len; i += 16) {
+        __mmask16 m = (len - i >= 16) ? (__mmask16)0xffff : (__mmask16)((1u << (len - i)) - 1);
+        s0 = _mm512_fmadd_ps(_mm512_maskz_loadu_ps(m, a + i), _mm512_maskz_loadu_ps(m, b + i), s0);
+    }
+    float part[16];
+    _mm512_storeu_ps(part, _mm512_add_ps(s0, s1));
+    float sum = 0.0f;
+    for (int k = 0; k < 16; k++) {
+        sum += part[k];
+    }
+    return sum;
+}
+
+#endif  // SIMD_X86
+
+/*
+ * Runtime dispatch: one table of kernels, filled in once at startup.
+ */
+typedef struct {
+    const char *isa;
+    void (*row_update_d)(double *__restrict, const double *__restrict, double, int);
+    void (*row_update_f)(float *__restrict, const float *__restrict, float, int);
+    double (*dot_d)(const double *__restrict, const double *__restrict, int);
+    float (*dot_f)(const float *__restrict, const float *__restrict, int);
+} simd_kernels_t;
+
+static simd_kernels_t simd_select()
+{
+#ifdef SIMD_X86
+    const char *cap = getenv("SIMD_ISA");
+    bool allow_avx512 = (cap == NULL || strcmp(cap, "avx512") == 0);
+    bool allow_avx2 = allow_avx512 || strcmp(cap, "avx2") == 0;
+
+    __builtin_cpu_init();
+    if (allow_avx512 && __builtin_cpu_supports("avx512f")) {
+        return { "avx512", row_update_avx512, row_update_avx512,
+                 dot_avx512, dot_avx512 };
+    }
+    if (allow_avx2 && __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) {
+        return { "avx2", row_update_avx2, row_update_avx2,
+                 dot_avx2, dot_avx2 };
+    }
+#endif
+    return { "scalar", row_update_scalar<double>, row_update_scalar<float>,
+             dot_scalar<double>, dot_scalar<float> };
+}
+
+static const simd_kernels_t simd_kernels = simd_select();
+
+static inline void row_update(double *dst, const double *src, double coeff, int len)
+{
+    simd_kernels.row_update_d(dst, src, coeff, len);
+}
+
+static inline void row_update(float *dst, const float *src, float coeff, int len)
+{
+    simd_kernels.row_update_f(dst, src, coeff, len);
+}
+
+static inline double dot(const double *a, const double *b, int len)
+{
+    return simd_kernels.dot_d(a, b, len);
+}
+
+static inline float dot(const float *a, const float *b, int len)
+{
+    return simd_kernels.dot_f(a, b, len);
+}
+
+/*
+ * long double has no vector instructions (x87 extended precision), so these
+ * always use the scalar versions; they let templated code such as solver.h
+ * call row_update() and dot() for every element type.
+ */
+static inline void row_update(long double *dst, const long double *src, long double coeff, int len)
+{
+    row_update_scalar(dst, src, coeff, len);
+}
+
+static inline long double dot(const long double *a, const long double *b, int len)
+{
+    return dot_scalar(a, b, len);
+}
+
+/*
+ * Name of the instruction set the kernels were selected for.
+ */
+static inline const char *simd_isa()
+{
+    return simd_kernels.isa;
+}
+
+#endif  // SIMD_H
@@ -0,0 +1,429 @@
+/**
+ * solver.h
+ *
+ * Templated Gaussian elimination solver, Solver<T, Policy>, for element
+ * types float, double and long double. The element type is a template
+ * parameter rather than the REAL macro, so one binary can run in any
+ * precision; the inner loops call the row_update() and dot() overloads for
+ * T from simd.h, which resolve at compile time to the AVX2/AVX-512 kernels
+ * for float and double and to scalar code for long double.
+ *
+ * Policy decides how the row loops run. It provides
+ *
+ *      Policy::threads()                       threads used by forall()
+ *      Policy::forall(begin, end, body)        body(i) for begin <= i < end
+ *      Policy::maxloc<T>(begin, end, value, &loc)
+ *                                              largest value(i) and its i
+ *      Policy::sum<T>(begin, end, value)       sum of value(i)
+ *      Policy::kernel(rowBegin, rowEnd, colBegin, colEnd, body)
+ *                                              body(row, c0, c1) for segments
+ *                                              [c0, c1) of each row that
+ *                                              cover the 2D range, in any
+ *                                              order
+ *
+ * kernel() runs the trailing submatrix update of each elimination step, so a
+ * policy may tile or collapse the two loops; each row segment is updated
+ * with row_update(). SerialPolicy and (with OpenMP)
+ * OpenMPPolicy are defined here; raja.cpp adds the RAJA ones.
+ *
+ * Example:
+ *
+ *      Solver<float, OpenMPPolicy> solver;
+ *      solver.n = 1000;
+ *      solver.generateRandomSystem();
+ *      solver.initPermutation();
+ *      solver.gaussianElimination();
+ *      solver.backSubstitution();
+ *      printf("ERR=%g\n", (double)solver.findMaxError());
+ */
+
+#ifndef SOLVER_H
+#define SOLVER_H
+
+#include <algorithm>
+#include <climits>
+#include <cmath>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#ifdef _OPENMP
+#   include <omp.h>
+#endif
+
+#include "simd.h"
+#include "matrix_io.h"
+#include "rng.h"
+
+// Uncomment this line to enable the alternative back substitution method
+//#define USE_COLUMN_BACKSUB
+
+// Rows per diagonal block in the multiple right-hand side back substitution
+#define SOLVER_BSUB_BLOCK 64
+
+// Runs the row loops on the calling thread
+struct SerialPolicy {
+    static int threads() { return 1; }
+
+    template <typename Body>
+    static void forall(int begin, int end, Body body) {
+        for (int i = begin; i < end; ++i) {
+            body(i);
+        }
+    }
+
+    template <typename T, typename Value>
+    static T maxloc(int begin, int end, Value value, int* loc) {
+        T best = -1.0;
+        *loc = begin;
+        for (int i = begin; i < end; ++i) {
+            T v = value(i);
+            if (v > best) {
+                best = v;
+                *loc = i;
+            }
+        }
+        return best;
+    }
+
+    template <typename T, typename Value>
+    static T sum(int begin, int end, Value value) {
+        T total = 0.0;
+        for (int i = begin; i < end; ++i) {
+            total += value(i);
+        }
+        return total;
+    }
+
+    template <typename Body>
+    static void kernel(int rowBegin, int rowEnd, int colBegin, int colEnd, Body body) {
+        for (int row = rowBegin; row < rowEnd; ++row) {
+            body(row, colBegin, colEnd);
+        }
+    }
+};
+
+#ifdef _OPENMP
+// Splits the row loops statically over the OpenMP threads
+struct OpenMPPolicy {
+    static int threads() { return omp_get_max_threads(); }
+
+    template <typename Body>
+    static void forall(int begin, int end, Body body) {
+        #pragma omp parallel for schedule(static)
+        for (int i = begin; i < end; ++i) {
+            body(i);
+        }
+    }
+
+    // Each thread finds the largest value in its rows, then the per-thread
+    // results are combined, keeping the lowest index on ties (as in the
+    // serial search)
+    template <typename T, typename Value>
+    static T maxloc(int begin, int end, Value value, int* loc) {
+        T best = -1.0;
+        int bestLoc = begin;
+        #pragma omp parallel
+        {
+            T myBest = -1.0;
+            int myLoc = begin;
+            #pragma omp for schedule(static) nowait
+            for (int i = begin; i < end; ++i) {
+                T v = value(i);
+                if (v > myBest) {
+                    myBest = v;
+                    myLoc = i;
+                }
+            }
+            #pragma omp critical
+            {
+                if (myBest > best || (myBest == best && myLoc < bestLoc)) {
+                    best = myBest;
+                    bestLoc = myLoc;
+                }
+            }
+        }
+        *loc = bestLoc;
+        return best;
+    }
+
+    template <typename T, typename Value>
+    static T sum(int begin, int end, Value value) {
+        T total = 0.0;
+        #pragma omp parallel for schedule(static) reduction(+:total)
+        for (int i = begin; i < end; ++i) {
+            total += value(i);
+        }
+        return total;
+    }
+
+    // Rows are split over the threads, each updated whole
+    template <typename Body>
+    static void kernel(int rowBegin, int rowEnd, int colBegin, int colEnd, Body body) {
+        #pragma omp parallel for schedule(static)
+        for (int row = rowBegin; row < rowEnd; ++row) {
+            body(row, colBegin, colEnd);
+        }
+    }
+};
+#endif
+
+template <typename T, typename Policy>
+class Solver {
+public:
+    int n = 0;
+    // Number of right-hand sides (b and x are n x nrhs, stored row-major)
+    int nrhs = 1;
+    // A is stored with rows lda >= n apart, padded and huge-page backed
+    // (see matrix_alloc.h)
+    int lda = 0;
+    std::vector<T, matrix_allocator<T>> A;
+    std::vector<T> x, b;
+    // Logical row i of A and b is stored in row perm[i] (partial pivoting)
+    std::vector<int> perm;
+    bool debug_mode = false;
+    bool triangular_mode = false;
+    bool pivot_mode = false;
+
+    void generateRandomSystem() {
+        lda = matrix_lda(n, sizeof(T));
+        A.resize((size_t)n * lda);
+        b.resize(n * nrhs);
+        x.resize(n * nrhs, 0);
+
+        // Each entry is a function of its row and column, so rows are generated
+        // in parallel and match the other backends; column j of the solution
+        // is all (j+1)s
+        Policy::forall(0, n, [=](int row) {
+            int colStart = triangular_mode ? row : 0;
+            for (int col = colStart; col < n; ++col) {
+                if (row != col) {
+                    A[row * lda + col] = static_cast<T>(rand_u31(RAND_SEED, row, col)) / ULONG_MAX;
+                } else {
+                    A[row * lda + col] = n / 10.0;
+                }
+            }
+            T sum = 0.0;
+            for (int col = 0; col < n; ++col) {
+                sum += A[row * lda + col];
+            }
+            for (int j = 0; j < nrhs; ++j) {
+                b[row * nrhs + j] = sum * (j + 1);
+            }
+        });
+    }
+
+    // Binary files must hold values of type T (see convert.cpp); text files
+    // are converted while parsing
+    void readSystemFromFile(const std::string& filename) {
+        // Binary files (see matrix_io.h) are mapped and copied in bulk
+        matrix_map_t mapped;
+        if (matrix_map(filename.c_str(), nrhs, sizeof(T), &mapped)) {
+            n = mapped.n;
+            const T* mA = static_cast<const T*>(mapped.A);
+            const T* mb = static_cast<const T*>(mapped.b);
+            assignMatrix(mA);
+            b.assign(mb, mb + (size_t)n * nrhs);
+            x.assign((size_t)n * nrhs, 0.0);
+            matrix_unmap(&mapped);
+            return;
+        }
+
+        // Text files are parsed in parallel into temporary buffers
+        T *tA, *tb;
+        matrix_read_text(filename.c_str(), nrhs, Policy::threads(), &n, &tA, &tb);
+        assignMatrix(tA);
+        b.assign(tb, tb + (size_t)n * nrhs);
+        x.assign((size_t)n * nrhs, 0.0);
+        free(tA);
+        free(tb);
+    }
+
+    // Copies a contiguous n x n matrix into A, padding its rows to lda
+    void assignMatrix(const T* src) {
+        lda = matrix_lda(n, sizeof(T));
+        A.assign((size_t)n * lda, 0.0);
+        for (int row = 0; row < n; ++row) {
+            std::copy(src + (size_t)row * n, src + (size_t)(row + 1) * n, &A[(size_t)row * lda]);
+        }
+    }
+
+    void initPermutation() {
+        perm.resize(n);
+        for (int row = 0; row < n; ++row) {
+            perm[row] = row;
+        }
+    }
+
+    // Partial pivoting: parallel max-abs search down the pivot column, then
+    // swap the winning row into place in perm (A and b are never copied)
+    void selectPivot(int pivot) {
+        int loc;
+        T best = Policy::template maxloc<T>(pivot, n, [=](int row) {
+            return std::fabs(A[perm[row] * lda + pivot]);
+        }, &loc);
+        if (best == 0.0) {
+            std::cerr << "Matrix is singular\n";
+            exit(EXIT_FAILURE);
+        }
+        std::swap(perm[pivot], perm[loc]);
+    }
+
+    // Gaussian elimination that also applies the row operations to b. The
+    // multipliers are kept below the diagonal, so A holds L and U afterwards.
+    void gaussianElimination() {
+        eliminate(true);
+    }
+
+    // Factors A in place into L (unit lower triangular, stored below the
+    // diagonal) and U, with row swaps recorded in perm. b is left untouched;
+    // use solve() for any number of right-hand sides afterwards.
+    void factor() {
+        eliminate(false);
+    }
+
+    // Solves for x using the factorization from factor(): forward substitution
+    // with L on the permuted b, then back substitution with U. O(n^2) per
+    // right-hand side.
+    void solve() {
+        for (int row = 0; row < n; ++row) {
+            int r = perm[row];
+            for (int j = 0; j < nrhs; ++j) {
+                x[row * nrhs + j] = b[r * nrhs + j];
+            }
+            if (nrhs == 1) {
+                x[row] -= dot(&A[r * lda], &x[0], row);
+            } else {
+                for (int col = 0; col < row; ++col) {
+                    row_update(&x[row * nrhs], &x[col * nrhs], A[r * lda + col], nrhs);
+                }
+            }
+        }
+        for (int row = n - 1; row >= 0; --row) {
+            int r = perm[row];
+            if (nrhs == 1) {
+                x[row] = (x[row] - dot(&A[r * lda] + row + 1, &x[row] + 1, n - row - 1)) / A[r * lda + row];
+            } else {
+                for (int col = row + 1; col < n; ++col) {
+                    row_update(&x[row * nrhs], &x[col * nrhs], A[r * lda + col], nrhs);
+                }
+                for (int j = 0; j < nrhs; ++j) {
+                    x[row * nrhs + j] /= A[r * lda + row];
+                }
+            }
+        }
+    }
+
+    // Each step computes the multipliers (and updates b) row by row, then
+    // updates the trailing submatrix with Policy::kernel()
+    void eliminate(bool withRhs) {
+        T* a = A.data();
+        const int* p = perm.data();
+        const int ld = lda;
+        for (int pivot = 0; pivot < n; ++pivot) {
+            if (pivot_mode) {
+                selectPivot(pivot);
+            }
+            int prow = perm[pivot];
+            Policy::forall(pivot + 1, n, [=](int row) {
+                int r = p[row];
+                T coeff = a[r * ld + pivot] / a[prow * ld + pivot];
+                a[r * ld + pivot] = coeff;
+                if (withRhs) {
+                    row_update(&b[r * nrhs], &b[prow * nrhs], coeff, nrhs);
+                }
+            });
+            Policy::kernel(pivot + 1, n, pivot + 1, n, [=](int row, int c0, int c1) {
+                int r = p[row];
+                row_update(&a[r * ld + c0], &a[prow * ld + c0], a[r * ld + pivot], c1 - c0);
+            });
+        }
+    }
+
+    void backSubstitution() {
+        #ifndef USE_COLUMN_BACKSUB
+        // Row-oriented: each x[row] is a (parallel) dot product with the
+        // solved values below it
+        for (int row = n - 1; row >= 0; --row) {
+            int r = perm[row];
+            T sum = Policy::template sum<T>(row + 1, n, [=](int col) {
+                return A[r * lda + col] * x[col];
+            });
+            x[row] = (b[r] - sum) / A[r * lda + row];
+        }
+        #else
+        // Column-oriented: once x[col] is solved, its column is subtracted
+        // from the rows above it in parallel
+        Policy::forall(0, n, [=](int row) {
+            x[row] = b[perm[row]];
+        });
+        for (int col = n - 1; col >= 0; --col) {
+            x[col] /= A[perm[col] * lda + col];
+            T xc = x[col];
+            Policy::forall(0, col, [=](int row) {
+                x[row] -= A[perm[row] * lda + col] * xc;
+            });
+        }
+        #endif
+    }
+
+    // Blocked triangular solve for all nrhs right-hand sides at once: for each
+    // block of SOLVER_BSUB_BLOCK rows (bottom to top), apply the already solved
+    // rows below it in parallel, then solve the small diagonal block
+    void backSubstitutionMulti() {
+        for (int i1 = n; i1 > 0; i1 -= SOLVER_BSUB_BLOCK) {
+            int i0 = std::max(i1 - SOLVER_BSUB_BLOCK, 0);
+            Policy::forall(i0, i1, [=](int row) {
+                int r = perm[row];
+                for (int j = 0; j < nrhs; ++j) {
+                    x[row * nrhs + j] = b[r * nrhs + j];
+                }
+                for (int col = i1; col < n; ++col) {
+                    row_update(&x[row * nrhs], &x[col * nrhs], A[r * lda + col], nrhs);
+                }
+            });
+            for (int row = i1 - 1; row >= i0; --row) {
+                int r = perm[row];
+                for (int col = row + 1; col < i1; ++col) {
+                    row_update(&x[row * nrhs], &x[col * nrhs], A[r * lda + col], nrhs);
+                }
+                for (int j = 0; j < nrhs; ++j) {
+                    x[row * nrhs + j] /= A[r * lda + row];
+                }
+            }
+        }
+    }
+
+    T findMaxError() const {
+        T maxError = 0.0;
+        for (int i = 0; i < n; ++i) {
+            for (int j = 0; j < nrhs; ++j) {
+                T error = std::fabs(x[i * nrhs + j] - (j + 1));
+                if (error > maxError) maxError = error;
+            }
+        }
+        return maxError;
+    }
+
+    void printMatrix(const T* mat, int rows, int cols, int ld) const {
+        for (int row = 0; row < rows; ++row) {
+            for (int col = 0; col < cols; ++col) {
+                std::cout << mat[row * ld + col] << " ";
+            }
+            std::cout << std::endl;
+        }
+    }
+
+    // Prints a matrix stored with the row permutation in logical row order
+    void printPermutedMatrix(const T* mat, int rows, int cols, int ld) const {
+        for (int row = 0; row < rows; ++row) {
+            for (int col = 0; col < cols; ++col) {
+                std::cout << mat[perm[row] * ld + col] << " ";
+            }
+            std::cout << std::endl;
+        }
+    }
+};
+
+#endif  // SOLVER_H
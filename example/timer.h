@@ -1,8 +1,9 @@
 /**
  * timer.h
  *
- * Custom timing macros for serial/OpenMP programs. Uses omp_get_wtime() if
- * _OPENMP is defined and gettimeofday() otherwise.
+ * Custom timing macros for serial/OpenMP/Pthread programs. All times come
+ * from the monotonic clock (clock_gettime(CLOCK_MONOTONIC)), which is safe to
+ * read from any thread.
  *
  * Example:
  *
@@ -16,19 +17,431 @@
  *
  *      printf("tag1: %8.4fs  tag2: %8.4fs\n",
  *          GET_TIMER(tag1), GET_TIMER(tag2));
+ *
+ * Profiling: set TIMER_PROFILE=<file>.json (or <file>.csv) in the environment
+ * to record a hierarchical per-thread profile and write it to that file when
+ * the program calls profile_write(). Each START_TIMER/STOP_TIMER pair is a
+ * top-level scope, and code can add nested scopes:
+ *
+ *      PROFILE_SCOPE("update");                    // times the enclosing block
+ *      PROFILE_SCOPE_BLOCK("update", pivot / 64);  // ... per pivot block
+ *
+ * Scopes are aggregated (count, total, min, max) per thread, per path (e.g.
+ * "gaus/update") and per block, so comparing threads shows load imbalance and
+ * time spent waiting at barriers. Scopes opened on worker threads outside any
+ * scope of their own are nested under the phase (top-level scope) the main
+ * thread has open, e.g. "gaus/update". When TIMER_PROFILE is not set a scope
+ * costs one predictable branch; compiling with -DNO_PROFILE removes the scopes
+ * altogether.
+ *
+ * Hardware counters: set TIMER_COUNTERS=1 to also count cycles, instructions,
+ * last-level cache misses, CPU time and (on Intel) retired single and double
+ * precision FP operations by vector width for each START_TIMER/STOP_TIMER
+ * phase, using Linux perf_event_open on every thread of the process.
+ * perf_report() then prints GFLOP/s, bytes moved from memory (LLC misses x 64
+ * bytes), IPC and the vectorized share of the FP operations per phase. Counters
+ * the machine or kernel doesn't provide (e.g. in a VM, or with
+ * perf_event_paranoid > 2) are reported as n/a.
  */
 
+#ifndef TIMER_H
+#define TIMER_H
+
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
 #ifdef _OPENMP
 #   include <omp.h>
-#   define START_TIMER(X) double _timer_ ## X = omp_get_wtime();
-#   define STOP_TIMER(X)  _timer_ ## X = omp_get_wtime() - (_timer_ ## X);
-#   define GET_TIMER(X)   (_timer_ ## X)
-#else
-#   include <sys/time.h>
-    struct timeval _tv;
-#   define START_TIMER(X) gettimeofday(&_tv, NULL); \
-        double _timer_ ## X = _tv.tv_sec+(_tv.tv_usec/1000000.0);
-#   define STOP_TIMER(X)  gettimeofday(&_tv, NULL); \
-        _timer_ ## X = _tv.tv_sec+(_tv.tv_usec/1000000.0) - (_timer_ ## X);
-#   define GET_TIMER(X)   (_timer_ ## X)
 #endif
+
+#ifdef __linux__
+#   include <linux/perf_event.h>
+#   include <sys/syscall.h>
+#   include <unistd.h>
+#endif
+
+static inline uint64_t timer_now_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}
+
+static inline double timer_now()
+{
+    return timer_now_ns() * 1e-9;
+}
+
+/*
+ * Hardware/software event counts for one phase (summed over all threads).
+ */
+enum {
+    PERF_CYCLES, PERF_INSTRUCTIONS, PERF_LLC_MISSES, PERF_TASK_CLOCK,
+    PERF_FP_SCALAR, PERF_FP_128, PERF_FP_256, PERF_FP_512,
+    PERF_FP_SCALAR_SP, PERF_FP_128_SP, PERF_FP_256_SP, PERF_FP_512_SP, PERF_NEVENTS
+};
+
+typedef struct {
+    double v[PERF_NEVENTS];
+} perf_counts_t;
+
+#ifdef __linux__
+
+static bool perf_available[PERF_NEVENTS];
+static int perf_fd[PERF_NEVENTS];
+
+/*
+ * Opens the counters on the calling thread at startup (before any other
+ * threads exist) when TIMER_COUNTERS is set. They are inherited by every
+ * thread created later, and reading them includes those threads' counts.
+ */
+static bool perf_init()
+{
+    const char *env = getenv("TIMER_COUNTERS");
+    if (env == NULL || env[0] == '\0' || strcmp(env, "0") == 0) {
+        return false;
+    }
+
+    // (type, config) per event; the FP events are Intel's
+    // FP_ARITH_INST_RETIRED.{SCALAR,128B,256B,512B}_PACKED_{DOUBLE,SINGLE}
+    static const uint32_t types[PERF_NEVENTS] = {
+        PERF_TYPE_HARDWARE, PERF_TYPE_HARDWARE, PERF_TYPE_HARDWARE, PERF_TYPE_SOFTWARE,
+        PERF_TYPE_RAW, PERF_TYPE_RAW, PERF_TYPE_RAW, PERF_TYPE_RAW,
+        PERF_TYPE_RAW, PERF_TYPE_RAW, PERF_TYPE_RAW, PERF_TYPE_RAW
+    };
+    static const uint64_t configs[PERF_NEVENTS] = {
+        PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS, PERF_COUNT_HW_CACHE_MISSES,
+        PERF_COUNT_SW_TASK_CLOCK, 0x01c7, 0x04c7, 0x10c7, 0x40c7,
+        0x02c7, 0x08c7, 0x20c7, 0x80c7
+    };
+#   if defined(__x86_64__) || defined(__i386__)
+    __builtin_cpu_init();   // perf_init() may run before libgcc has set up __cpu_model
+    bool intel = __builtin_cpu_is("intel");
+#   else
+    bool intel = false;
+#   endif
+
+    for (int e = 0; e < PERF_NEVENTS; e++) {
+        perf_fd[e] = -1;
+        if (types[e] == PERF_TYPE_RAW && !intel) {
+            continue;
+        }
+        struct perf_event_attr attr;
+        memset(&attr, 0, sizeof(attr));
+        attr.size = sizeof(attr);
+        attr.type = types[e];
+        attr.config = configs[e];
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        attr.inherit = 1;
+        attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+        perf_fd[e] = (int)syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+        perf_available[e] = (perf_fd[e] >= 0);
+    }
+    return true;
+}
+
+static const bool perf_enabled = perf_init();
+
+/*
+ * Returns the current counts summed over all threads (zero if disabled),
+ * scaled up for the time each event was multiplexed out.
+ */
+static perf_counts_t perf_read()
+{
+    perf_counts_t c;
+    memset(&c, 0, sizeof(c));
+    if (!perf_enabled) {
+        return c;
+    }
+    for (int e = 0; e < PERF_NEVENTS; e++) {
+        uint64_t val[3];    // value, time enabled, time running
+        if (perf_fd[e] >= 0 && read(perf_fd[e], val, sizeof(val)) == (ssize_t)sizeof(val) &&
+                val[2] > 0) {
+            c.v[e] = (double)val[0] * ((double)val[1] / (double)val[2]);
+        }
+    }
+    return c;
+}
+
+#else   // !__linux__
+
+static bool perf_available[PERF_NEVENTS];
+static const bool perf_enabled = false;
+static perf_counts_t perf_read()
+{
+    perf_counts_t c;
+    memset(&c, 0, sizeof(c));
+    return c;
+}
+
+#endif  // __linux__
+
+static inline perf_counts_t perf_delta(perf_counts_t start)
+{
+    perf_counts_t c = start;
+    if (perf_enabled) {
+        c = perf_read();
+        for (int e = 0; e < PERF_NEVENTS; e++) {
+            c.v[e] -= start.v[e];
+        }
+    }
+    return c;
+}
+
+static void perf_report_phase(const char *name, perf_counts_t c, double secs)
+{
+    printf("  %s:", name);
+    if (perf_available[PERF_FP_SCALAR]) {
+        // operations per instruction = vector width / element size
+        double packed = c.v[PERF_FP_128]*2 + c.v[PERF_FP_256]*4 + c.v[PERF_FP_512]*8 +
+                c.v[PERF_FP_128_SP]*4 + c.v[PERF_FP_256_SP]*8 + c.v[PERF_FP_512_SP]*16;
+        double flops = c.v[PERF_FP_SCALAR] + c.v[PERF_FP_SCALAR_SP] + packed;
+        printf(" %8.2f GFLOP/s  vec %3.0f%%", flops / secs * 1e-9,
+                flops > 0 ? 100.0 * packed / flops : 0.0);
+    } else {
+        printf("      n/a GFLOP/s  vec  n/a");
+    }
+    if (perf_available[PERF_LLC_MISSES]) {
+        printf("  %9.1f MB", c.v[PERF_LLC_MISSES] * 64 * 1e-6);
+    } else {
+        printf("        n/a MB");
+    }
+    if (perf_available[PERF_CYCLES] && perf_available[PERF_INSTRUCTIONS] &&
+            c.v[PERF_CYCLES] > 0) {
+        printf("  IPC %4.2f", c.v[PERF_INSTRUCTIONS] / c.v[PERF_CYCLES]);
+    } else {
+        printf("  IPC  n/a");
+    }
+    if (perf_available[PERF_TASK_CLOCK]) {
+        printf("  CPU %8.4fs", c.v[PERF_TASK_CLOCK] * 1e-9);
+    }
+}
+
+/*
+ * Prints the per-phase counter summary (after the Nthreads=... line) when
+ * TIMER_COUNTERS is set.
+ */
+static void perf_report(perf_counts_t init, double init_s, perf_counts_t gaus, double gaus_s,
+        perf_counts_t bsub, double bsub_s)
+{
+    if (!perf_enabled) {
+        return;
+    }
+    printf("COUNTERS");
+    perf_report_phase("INIT", init, init_s);
+    perf_report_phase("GAUS", gaus, gaus_s);
+    perf_report_phase("BSUB", bsub, bsub_s);
+    printf("\n");
+}
+
+#define START_TIMER(X) double _timer_ ## X = timer_now(); \
+        perf_counts_t _counters_ ## X = perf_read(); profile_begin(#X, -1);
+#define STOP_TIMER(X)  profile_end(); _counters_ ## X = perf_delta(_counters_ ## X); \
+        _timer_ ## X = timer_now() - (_timer_ ## X);
+#define GET_TIMER(X)    (_timer_ ## X)
+#define GET_COUNTERS(X) (_counters_ ## X)
+
+#ifndef NO_PROFILE
+
+/*
+ * One node of a thread's scope tree (a scope name and block under a parent).
+ */
+typedef struct profile_node {
+    const char *name;
+    int block;                          // pivot block (-1 = none)
+    const struct profile_node *outer;   // main-thread phase this is nested in
+                                        // (worker threads' top-level scopes)
+    struct profile_node *parent;
+    struct profile_node *child;
+    struct profile_node *sibling;
+    long count;
+    uint64_t total, min, max, start;    // nanoseconds
+} profile_node_t;
+
+typedef struct profile_thread {
+    int id;                             // registration order (main thread = 0)
+    profile_node_t root;
+    profile_node_t *current;
+    struct profile_thread *next;
+} profile_thread_t;
+
+static const char *profile_path = getenv("TIMER_PROFILE");
+static const bool profile_enabled = (profile_path != NULL && profile_path[0] != '\0');
+static pthread_mutex_t profile_lock = PTHREAD_MUTEX_INITIALIZER;
+static profile_thread_t *profile_threads = NULL;
+static int profile_nthreads = 0;
+static thread_local profile_thread_t *profile_self = NULL;
+static profile_node_t *profile_main_phase = NULL;      // main thread's open phase
+
+static profile_thread_t *profile_register()
+{
+    profile_thread_t *t = (profile_thread_t *)calloc(1, sizeof(profile_thread_t));
+    t->current = &t->root;
+    pthread_mutex_lock(&profile_lock);
+    t->id = profile_nthreads++;
+    profile_thread_t **tail = &profile_threads;
+    while (*tail != NULL) {
+        tail = &(*tail)->next;
+    }
+    *tail = t;
+    pthread_mutex_unlock(&profile_lock);
+    profile_self = t;
+    return t;
+}
+
+static inline void profile_begin(const char *name, int block)
+{
+    if (!profile_enabled) {
+        return;
+    }
+    profile_thread_t *t = (profile_self != NULL) ? profile_self : profile_register();
+    profile_node_t *parent = t->current;
+    const profile_node_t *outer = NULL;
+    if (parent == &t->root && t->id != 0) {
+        outer = __atomic_load_n(&profile_main_phase, __ATOMIC_ACQUIRE);
+    }
+
+    // find (or add) the child for this name and block
+    profile_node_t **link = &parent->child;
+    profile_node_t *c = parent->child;
+    while (c != NULL && !(c->block == block && c->outer == outer &&
+                (c->name == name || strcmp(c->name, name) == 0))) {
+        link = &c->sibling;
+        c = c->sibling;
+    }
+    if (c == NULL) {
+        c = (profile_node_t *)calloc(1, sizeof(profile_node_t));
+        c->name = name;
+        c->block = block;
+        c->outer = outer;
+        c->parent = parent;
+        c->min = UINT64_MAX;
+        *link = c;
+    }
+    t->current = c;
+    if (t->id == 0 && parent == &t->root) {
+        __atomic_store_n(&profile_main_phase, c, __ATOMIC_RELEASE);
+    }
+    c->start = timer_now_ns();
+}
+
+static inline void profile_end()
+{
+    if (!profile_enabled) {
+        return;
+    }
+    uint64_t now = timer_now_ns();
+    profile_thread_t *t = profile_self;
+    profile_node_t *c = t->current;
+    uint64_t d = now - c->start;
+    c->count++;
+    c->total += d;
+    c->min = (d < c->min) ? d : c->min;
+    c->max = (d > c->max) ? d : c->max;
+    t->current = c->parent;
+    if (t->id == 0 && c->parent == &t->root) {
+        __atomic_store_n(&profile_main_phase, (profile_node_t *)NULL, __ATOMIC_RELEASE);
+    }
+}
+
+struct profile_scope_t {
+    profile_scope_t(const char *name, int block) { profile_begin(name, block); }
+    ~profile_scope_t() { profile_end(); }
+};
+
+#define PROFILE_CAT2(a, b) a ## b
+#define PROFILE_CAT(a, b)  PROFILE_CAT2(a, b)
+#define PROFILE_SCOPE(name) \
+    profile_scope_t PROFILE_CAT(_profile_scope_, __LINE__)(name, -1)
+#define PROFILE_SCOPE_BLOCK(name, block) \
+    profile_scope_t PROFILE_CAT(_profile_scope_, __LINE__)(name, block)
+
+/*
+ * Writes the slash-separated path of a node (e.g. "gaus/update").
+ */
+static void profile_path_of(const profile_node_t *c, char *buf, size_t len)
+{
+    if (c == NULL || c->name == NULL) {
+        buf[0] = '\0';
+        return;
+    }
+    if (c->parent != NULL && c->parent->name != NULL) {
+        profile_path_of(c->parent, buf, len);
+    } else {
+        profile_path_of(c->outer, buf, len);
+    }
+    size_t used = strlen(buf);
+    snprintf(buf + used, len - used, "%s%s", used ? "/" : "", c->name);
+}
+
+static void profile_write_node(FILE *fout, bool csv, int tid, const profile_node_t *c, bool *first)
+{
+    for (; c != NULL; c = c->sibling) {
+        char path[512];
+        profile_path_of(c, path, sizeof(path));
+        if (c->count > 0) {
+            double total = c->total * 1e-9, mean = total / c->count;
+            if (csv) {
+                fprintf(fout, "%d,%s,%d,%ld,%.9f,%.9f,%.9f,%.9f\n", tid, path,
+                        c->block, c->count, total, mean, c->min * 1e-9, c->max * 1e-9);
+            } else {
+                fprintf(fout, "%s\n    {\"thread\": %d, \"path\": \"%s\", \"block\": %d, "
+                        "\"count\": %ld, \"total\": %.9f, \"mean\": %.9f, "
+                        "\"min\": %.9f, \"max\": %.9f}", *first ? "" : ",", tid, path,
+                        c->block, c->count, total, mean, c->min * 1e-9, c->max * 1e-9);
+                *first = false;
+            }
+        }
+        profile_write_node(fout, csv, tid, c->child, first);
+    }
+}
+
+/*
+ * Writes the profile to the file named by TIMER_PROFILE (CSV if the name ends
+ * in ".csv", JSON otherwise). Call once at the end of the program, when no
+ * other thread is inside a scope. Does nothing if profiling is disabled.
+ */
+static void profile_write()
+{
+    if (!profile_enabled) {
+        return;
+    }
+    FILE *fout = fopen(profile_path, "w");
+    if (fout == NULL) {
+        fprintf(stderr, "Unable to write profile \"%s\"\n", profile_path);
+        return;
+    }
+    size_t len = strlen(profile_path);
+    bool csv = (len >= 4 && strcmp(profile_path + len - 4, ".csv") == 0);
+    bool first = true;
+    if (csv) {
+        fprintf(fout, "thread,path,block,count,total_s,mean_s,min_s,max_s\n");
+    } else {
+        fprintf(fout, "{\"threads\": %d, \"scopes\": [", profile_nthreads);
+    }
+    for (profile_thread_t *t = profile_threads; t != NULL; t = t->next) {
+        profile_write_node(fout, csv, t->id, t->root.child, &first);
+    }
+    if (!csv) {
+        fprintf(fout, "\n]}\n");
+    }
+    fclose(fout);
+}
+
+#else   // NO_PROFILE
+
+static const bool profile_enabled = false;
+static inline void profile_begin(const char *, int) {}
+static inline void profile_end() {}
+static inline void profile_write() {}
+#define PROFILE_SCOPE(name)
+#define PROFILE_SCOPE_BLOCK(name, block)
+
+#endif  // NO_PROFILE
+
+#endif  // TIMER_H
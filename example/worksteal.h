@@ -0,0 +1,186 @@
+/**
+ * worksteal.h
+ *
+ * Work-stealing scheduler for the Pthread backend's pool.
+ *
+ * A job is split into ntasks tasks (e.g. tiles of rows), numbered
+ * 0..ntasks-1. ws_fill() gives every thread a contiguous range of them in
+ * its own deque, so without stealing each thread works on the same rows as
+ * with a static partition (and on the pages it first touched). A thread
+ * takes tasks from the bottom of its own deque in ascending order, and once
+ * it runs out it steals from the top of other threads' deques, starting at a
+ * random victim, until every deque is empty. A thread that is preempted or
+ * runs on a slower core therefore only delays the tasks it is working on,
+ * not its whole share of the job.
+ *
+ * The deques are the lock-free Chase-Lev deques (Chase and Lev, "Dynamic
+ * Circular Work-Stealing Deque", SPAA 2005). Tasks are only added by
+ * ws_fill() between jobs, while no thread is taking tasks, so the buffers
+ * never wrap or grow while they are in use.
+ *
+ * Example:
+ *
+ *      ws_init(&ws, nthreads);                     // once
+ *      ws_fill(&ws, ntasks);                       // before each job
+ *      while (ws_next(&ws, tid, &task)) {          // in each thread
+ *          ...
+ *      }
+ *      ws_destroy(&ws);
+ */
+
+#ifndef WORKSTEAL_H
+#define WORKSTEAL_H
+
+#include <stdio.h>
+#include <stdlib.h>
+
+typedef struct {
+    long      top;          // next task to steal (updated atomically)
+    long      bottom;       // one past the owner's next task (updated atomically)
+    int      *tasks;        // tasks[top..bottom-1], the owner's next at bottom-1
+    int       capacity;
+    unsigned  seed;         // victim selection for the owner
+} __attribute__((aligned(64))) ws_deque_t;
+
+typedef struct {
+    int         nthreads;
+    ws_deque_t *deques;     // one per thread
+} ws_sched_t;
+
+// result of a steal attempt
+enum { WS_STOLEN, WS_EMPTY, WS_RETRY };
+
+/*
+ * Creates one (empty) deque per thread.
+ */
+static void ws_init(ws_sched_t *ws, int nthreads)
+{
+    ws->nthreads = nthreads;
+    ws->deques = (ws_deque_t *)aligned_alloc(64, sizeof(ws_deque_t) * nthreads);
+    if (ws->deques == NULL) {
+        fprintf(stderr, "Memory allocation failed\n");
+        exit(EXIT_FAILURE);
+    }
+    for (int t = 0; t < nthreads; t++) {
+        ws_deque_t *d = &ws->deques[t];
+        d->top = d->bottom = 0;
+        d->tasks = NULL;
+        d->capacity = 0;
+        d->seed = 2654435761u * (t + 1);
+    }
+}
+
+static void ws_destroy(ws_sched_t *ws)
+{
+    for (int t = 0; t < ws->nthreads; t++) {
+        free(ws->deques[t].tasks);
+    }
+    free(ws->deques);
+}
+
+/*
+ * Distributes tasks 0..ntasks-1 over the deques, thread t getting the t-th
+ * contiguous range. Call only while no thread is taking tasks (e.g. before
+ * the pool starts the job, or between two barriers).
+ */
+static void ws_fill(ws_sched_t *ws, int ntasks)
+{
+    for (int t = 0; t < ws->nthreads; t++) {
+        ws_deque_t *d = &ws->deques[t];
+        int lo = (int)((long)ntasks * t / ws->nthreads);
+        int hi = (int)((long)ntasks * (t + 1) / ws->nthreads);
+        if (hi - lo > d->capacity) {
+            d->capacity = hi - lo;
+            d->tasks = (int *)realloc(d->tasks, sizeof(int) * d->capacity);
+            if (d->tasks == NULL) {
+                fprintf(stderr, "Memory allocation failed\n");
+                exit(EXIT_FAILURE);
+            }
+        }
+        // stored in reverse, so the owner takes them in ascending order
+        for (int i = 0; i < hi - lo; i++) {
+            d->tasks[i] = hi - 1 - i;
+        }
+        __atomic_store_n(&d->top, 0, __ATOMIC_RELAXED);
+        __atomic_store_n(&d->bottom, (long)(hi - lo), __ATOMIC_RELEASE);
+    }
+}
+
+/*
+ * Takes the owner's next task from the bottom of its deque.
+ */
+static bool ws_pop(ws_deque_t *d, int *task)
+{
+    long b = __atomic_load_n(&d->bottom, __ATOMIC_RELAXED) - 1;
+    __atomic_store_n(&d->bottom, b, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    long t = __atomic_load_n(&d->top, __ATOMIC_RELAXED);
+    if (t > b) {
+        __atomic_store_n(&d->bottom, b + 1, __ATOMIC_RELAXED);
+        return false;
+    }
+    *task = d->tasks[b];
+    if (t == b) {
+        // last task: race any thief for it
+        bool won = __atomic_compare_exchange_n(&d->top, &t, t + 1, false,
+                __ATOMIC_SEQ_CST, __ATOMIC_RELAXED);
+        __atomic_store_n(&d->bottom, b + 1, __ATOMIC_RELAXED);
+        return won;
+    }
+    return true;
+}
+
+/*
+ * Tries to take a task from the top of another thread's deque.
+ */
+static int ws_steal(ws_deque_t *d, int *task)
+{
+    long t = __atomic_load_n(&d->top, __ATOMIC_ACQUIRE);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    long b = __atomic_load_n(&d->bottom, __ATOMIC_ACQUIRE);
+    if (t >= b) {
+        return WS_EMPTY;
+    }
+    int stolen = d->tasks[t];
+    if (!__atomic_compare_exchange_n(&d->top, &t, t + 1, false,
+                __ATOMIC_SEQ_CST, __ATOMIC_RELAXED)) {
+        return WS_RETRY;
+    }
+    *task = stolen;
+    return WS_STOLEN;
+}
+
+/*
+ * Gets the next task for thread tid: its own next task, or else one stolen
+ * from another thread (trying all of them, starting at a random one).
+ * Returns false once every deque is empty.
+ */
+static bool ws_next(ws_sched_t *ws, int tid, int *task)
+{
+    ws_deque_t *own = &ws->deques[tid];
+    if (ws_pop(own, task)) {
+        return true;
+    }
+    while (ws->nthreads > 1) {
+        own->seed = own->seed * 1103515245u + 12345u;
+        int start = (int)((own->seed >> 16) % (unsigned)ws->nthreads);
+        bool retry = false;
+        for (int i = 0; i < ws->nthreads; i++) {
+            int victim = (start + i) % ws->nthreads;
+            if (victim == tid) {
+                continue;
+            }
+            int result = ws_steal(&ws->deques[victim], task);
+            if (result == WS_STOLEN) {
+                return true;
+            }
+            retry |= (result == WS_RETRY);
+        }
+        if (!retry) {
+            break;
+        }
+    }
+    return false;
+}
+
+#endif  // WORKSTEAL_H
@@ -7,38 +7,14 @@
 
 sizes=(300 424 599 847 1197 1692 2392 3382 4782 6762 9562)
 threads=(1 2 4 8)
-serials=(1)
 
-echo "Serial:"
-for t in "${serials[@]}"; do
-    export OMP_NUM_THREADS=$t
-    for s in "${sizes[@]}"; do
-        echo "Size: $s, Threads: $t"
-        ./example/out/serial $s
-    done
-done
-
-printf "\n"
-printf "\n"
-echo "OpenMP:"
-for t in "${threads[@]}"; do
-    export OMP_NUM_THREADS=$t
-    for s in "${sizes[@]}"; do
-        echo "Size: $s, Threads: $t"
-        ./example/out/openmp $s
-    done
-done
-
-printf "\n"
-printf "\n"
-echo "Pthread:"
-for t in "${threads[@]}"; do
-    export OMP_NUM_THREADS=$t
-    for s in "${sizes[@]}"; do
-        echo "Size: $s, Threads: $t"
-        ./example/out/pthread $s
-    done
-done
+echo "Serial, OpenMP, Pthread:"
+# the benchmark driver runs warmups and repeated trials of every configuration
+# and writes median/percentile times and GFLOP/s as CSV (see example/bench.cpp)
+./example/out/bench -P -L ./example/out -B serial,openmp,pthread \
+    -n "$(IFS=,; echo "${sizes[*]}")" -T "$(IFS=,; echo "${threads[*]}")" \
+    -o timing_noncluster.csv
+cat timing_noncluster.csv
 
 printf "\n"
 printf "\n"